@@ -0,0 +1,147 @@
+#define HH_IMPLEMENTATION
+#define HH_STRIP_PREFIXES
+#include "h.h"
+
+#include <stdbool.h>
+#include <time.h>
+
+// benchmarks for hh_arena
+// usage: ./hh_arena_bench [benchmark] [count]
+// runs every benchmark when none is given
+
+static double
+bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// keeps the optimizer from discarding a benchmark's result
+static volatile size_t bench_sink;
+
+// the previous hh_arena_alloc, kept as a baseline
+// walks the page chain from the front and never aligns
+static void*
+bench_arena_alloc_walk(hh_arena* page, size_t sz) {
+    if(page->ptr == NULL) {
+        size_t sz_alloc = HH_MAX(HH_ARENA_DEFAULT_SIZE, sz);
+        page->ptr = malloc(sz_alloc);
+        if(page->ptr == NULL) return NULL;
+        page->end = page->ptr + sz_alloc;
+        page->cur = page->ptr + sz;
+        return page->ptr;
+    }
+    if((size_t) (page->end - page->cur) < sz) {
+        if(page->next == NULL) page->next = calloc(1, sizeof(hh_arena));
+        if(page->next == NULL) return NULL;
+        return bench_arena_alloc_walk(page->next, sz);
+    }
+    void* ptr = page->cur;
+    page->cur += sz;
+    return ptr;
+}
+
+static void
+bench_alloc(size_t count) {
+    // count allocations of 8-24 bytes, touching the first byte of each
+    printf("alloc: %zu allocations of 8-24 bytes\n", count);
+    printf("  %-24s  %9s  %10s  %12s\n", "allocator", "seconds", "ns/alloc", "misaligned");
+    static const char* labels[] = { "chain walk (previous)", "hh_arena_alloc", "malloc" };
+    for(int run = 0; run < 3; ++run) {
+        arena storage = {0};
+        void** ptrs = (run == 2) ? malloc(sizeof(void*) * count) : NULL;
+        if(run == 2) ASSERT(ptrs != NULL, "Failed to allocate pointer buffer");
+        size_t misaligned = 0;
+        double start = bench_now();
+        for(size_t i = 0; i < count; ++i) {
+            size_t sz = 8 + i % 17;
+            char* ptr;
+            if(run == 0) ptr = bench_arena_alloc_walk(&storage, sz);
+            else if(run == 1) ptr = arena_alloc(&storage, sz);
+            else ptr = ptrs[i] = malloc(sz);
+            ASSERT(ptr != NULL, "Allocation failed: i = %zu", i);
+            ptr[0] = (char) i;
+            misaligned += ((uintptr_t) ptr % HH_ARENA_ALIGN != 0);
+        }
+        double elapsed = bench_now() - start;
+        bench_sink = misaligned;
+        if(run == 2) {
+            for(size_t i = 0; i < count; ++i) free(ptrs[i]);
+            free(ptrs);
+        }
+        arena_free(&storage);
+        printf("  %-24s  %9.3lf  %10.1lf  %12zu\n", labels[run], elapsed, elapsed * 1e9 / (double) count, misaligned);
+    }
+}
+
+// pages currently owned by an arena
+static size_t
+bench_page_count(hh_arena* storage) {
+    size_t pages = (storage->ptr != NULL);
+    for(hh_arena* page = storage->next; page != NULL; page = page->next) ++pages;
+    return pages;
+}
+
+#define REQUEST_ALLOCS 4096
+
+static void
+bench_request(size_t count) {
+    // count allocations of 64-191 bytes, in requests of REQUEST_ALLOCS (~500 KiB of scratch each)
+    // every request also opens a nested scope that is rewound before it ends
+    size_t requests = count / REQUEST_ALLOCS;
+    printf("request: %zu requests of %d allocations of 64-191 bytes\n", requests, REQUEST_ALLOCS);
+    printf("  %-24s  %9s  %12s  %14s\n", "between requests", "seconds", "ns/request", "pages malloc'd");
+    static const char* labels[] = { "malloc + free", "hh_arena_free", "hh_arena_reset" };
+    for(int run = 0; run < 3; ++run) {
+        arena storage = {0};
+        void** ptrs = (run == 0) ? malloc(sizeof(void*) * REQUEST_ALLOCS) : NULL;
+        if(run == 0) ASSERT(ptrs != NULL, "Failed to allocate pointer buffer");
+        size_t pages = 0, sum = 0;
+        double start = bench_now();
+        for(size_t r = 0; r < requests; ++r) {
+            size_t pages_before = bench_page_count(&storage);
+            arena_mark_t scope = {0};
+            for(size_t i = 0; i < REQUEST_ALLOCS; ++i) {
+                if(run != 0 && i == REQUEST_ALLOCS / 2) scope = arena_mark(&storage);
+                size_t sz = 64 + (r + i) % 128;
+                char* ptr = (run == 0) ? (ptrs[i] = malloc(sz)) : arena_alloc(&storage, sz);
+                ASSERT(ptr != NULL, "Allocation failed: i = %zu", i);
+                ptr[0] = (char) i;
+                sum += (size_t) ptr[0];
+            }
+            if(run == 0) {
+                for(size_t i = 0; i < REQUEST_ALLOCS; ++i) free(ptrs[i]);
+                continue;
+            }
+            arena_rewind(&storage, scope);
+            pages += bench_page_count(&storage) - pages_before;
+            if(run == 1) arena_free(&storage);
+            else arena_reset(&storage);
+        }
+        double elapsed = bench_now() - start;
+        bench_sink = sum;
+        free(ptrs);
+        arena_free(&storage);
+        // malloc + free allocates every object separately, so pages don't apply
+        char pages_str[32] = "-";
+        if(run != 0) snprintf(pages_str, sizeof(pages_str), "%zu", pages);
+        printf("  %-24s  %9.3lf  %12.1lf  %14s\n", labels[run], elapsed, 
+            elapsed * 1e9 / (double) HH_MAX(requests, 1), pages_str);
+    }
+}
+
+int
+main(int argc, char* argv[]) {
+    const char* name = (argc > 1) ? argv[1] : NULL;
+    size_t count = (argc > 2) ? strtoul(argv[2], NULL, 10) : 10000000;
+    bool any = false;
+#define BENCH(bench) if(name == NULL || strcmp(name, #bench) == 0) { any = true; bench_##bench(count); }
+    BENCH(alloc);
+    BENCH(request);
+#undef BENCH
+    if(!any) {
+        ERR("Unrecognized benchmark: %s", name);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,424 @@
+#include <stddef.h>
+
+// every array in this file allocates through the hooks below,
+// so bench_grow can count relocations and switch growth policies at runtime
+static void* 
+bench_realloc(void* ptr, size_t size);
+static size_t 
+bench_grow_policy(size_t cap, size_t min_cap, size_t elem_size);
+#define HH_DARR_REALLOC(ptr, size) bench_realloc((ptr), (size))
+#define HH_DARR_GROW(cap, min_cap, elem_size) bench_grow_policy((cap), (min_cap), (elem_size))
+
+#define HH_IMPLEMENTATION
+#define HH_STRIP_PREFIXES
+#include "h.h"
+
+#include <stdbool.h>
+#include <time.h>
+// bench_grow runs each policy in a forked child to report its peak RSS
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif // _WIN32
+
+// benchmarks for hh_darr
+// usage: ./hh_darr_bench [benchmark] [count]
+// runs every benchmark when none is given
+
+static double
+bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// keeps the optimizer from discarding a benchmark's result
+static volatile size_t bench_sink;
+
+// allocator and growth policy selected by bench_grow
+static struct {
+    enum { GROW_DOUBLE, GROW_HALF, GROW_HALF_PAGES } policy;
+    bool copy; // relocate with malloc + memcpy instead of realloc
+    size_t reallocs, relocated, mallocs;
+} bench_grow_state;
+
+static void*
+bench_realloc(void* ptr, size_t size) {
+    if(ptr == NULL) ++bench_grow_state.mallocs;
+    if(ptr == NULL || !bench_grow_state.copy) {
+        void* ptr_new = realloc(ptr, size);
+        ++bench_grow_state.reallocs;
+        if(ptr != NULL && ptr_new != ptr) {
+            hh_darrheader_t* hdr = ptr_new;
+            bench_grow_state.relocated += sizeof(hh_darrheader_t) + hdr->len * hdr->elem_size;
+        }
+        return ptr_new;
+    }
+    // an allocator without in-place growth (or mremap) copies every live byte
+    hh_darrheader_t* hdr = ptr;
+    size_t size_old = sizeof(hh_darrheader_t) + hdr->len * hdr->elem_size;
+    void* ptr_new = malloc(size);
+    if(ptr_new == NULL) return NULL;
+    memcpy(ptr_new, ptr, HH_MIN(size, size_old));
+    free(ptr);
+    ++bench_grow_state.reallocs;
+    bench_grow_state.relocated += size_old;
+    return ptr_new;
+}
+
+static size_t
+bench_grow_policy(size_t cap, size_t min_cap, size_t elem_size) {
+    switch(bench_grow_state.policy) {
+        case GROW_HALF: 
+            return HH_MAX(cap + cap / 2, HH_MAX(min_cap, HH_ARR_CAP_DEFAULT));
+        case GROW_HALF_PAGES: {
+            // 1.5x, rounded up to whole pages
+#ifdef _WIN32
+            SYSTEM_INFO info;
+            GetSystemInfo(&info);
+            size_t page = (size_t) info.dwPageSize;
+#else
+            size_t page = (size_t) sysconf(_SC_PAGESIZE);
+#endif // _WIN32
+            size_t bytes = HH_MAX(cap + cap / 2, HH_MAX(min_cap, HH_ARR_CAP_DEFAULT)) * elem_size + sizeof(hh_darrheader_t);
+            bytes = (bytes + page - 1) / page * page;
+            return (bytes - sizeof(hh_darrheader_t)) / elem_size;
+        }
+        default: 
+            return HH__darrgrowcap(cap, min_cap);
+    }
+}
+
+// fields per line in bench_append
+#define APPEND_FIELDS 64
+
+static void
+bench_append(size_t count) {
+    // builds count CSV-like lines in a reused buffer, so only the appends are timed
+    static const char field[] = "1672531200.125,";
+    size_t len_field = sizeof(field) - 1;
+    printf("append: %zu lines of %d %zu-byte fields\n", count / APPEND_FIELDS, APPEND_FIELDS, len_field);
+    char* str = NULL;
+    double start = bench_now();
+    for(size_t i = 0; i < count; ++i) {
+        if(i % APPEND_FIELDS == 0) darrclear(str);
+        for(size_t k = 0; k < len_field; ++k) darrput(str, field[k]);
+    }
+    double elapsed_put = bench_now() - start;
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) {
+        if(i % APPEND_FIELDS == 0) darrclear(str);
+        (void) darradd(str, len_field);
+        memcpy(str + darrlen(str) - len_field, field, len_field);
+    }
+    double elapsed_add = bench_now() - start;
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) {
+        if(i % APPEND_FIELDS == 0) darrclear(str);
+        (void) darrputstr(str, field);
+    }
+    double elapsed_putstr = bench_now() - start;
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) {
+        if(i % APPEND_FIELDS == 0) darrclear(str);
+        (void) darrputn(str, field, len_field);
+    }
+    double elapsed_putn = bench_now() - start;
+    bench_sink = darrlen(str);
+    darrfree(str);
+    double bytes = (double) (count * len_field) * 1e-6;
+    printf("  hh_darrput (per byte):    %8.2lf MB/s\n", bytes / elapsed_put);
+    printf("  hh_darradd + memcpy:      %8.2lf MB/s\n", bytes / elapsed_add);
+    printf("  hh_darrputstr:            %8.2lf MB/s\n", bytes / elapsed_putstr);
+    printf("  hh_darrputn:              %8.2lf MB/s\n", bytes / elapsed_putn);
+}
+
+// splitmix64, used to generate indices
+static uint64_t
+bench_rand(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// the byte-wise XOR swap hh_darrswap used to perform, as a baseline
+static void
+bench_swap_bytes(void* arr, size_t i, size_t j) {
+    if(i == j) return;
+    size_t elem_size = hh_darrheader(arr)->elem_size;
+    char* elem_i = ((char*) arr) + i * elem_size;
+    char* elem_j = ((char*) arr) + j * elem_size;
+    for(size_t k = 0; k < elem_size; ++k) {
+        elem_i[k] = elem_i[k] ^ elem_j[k];
+        elem_j[k] = elem_i[k] ^ elem_j[k];
+        elem_i[k] = elem_i[k] ^ elem_j[k];
+    }
+}
+
+// Fisher-Yates shuffles of count elements of elem_size bytes, returns Mswaps/s
+static double
+bench_swap_run(size_t count, size_t elem_size, bool bytes) {
+    unsigned char* arr = NULL;
+    (void) darradd(arr, count * elem_size);
+    hh_darrheader(arr)->len = count;
+    hh_darrheader(arr)->elem_size = elem_size;
+    uint64_t state = 42;
+    double start = bench_now();
+    for(size_t i = count; i > 1; --i) {
+        size_t j = (size_t) (bench_rand(&state) % i);
+        if(bytes) bench_swap_bytes(arr, i - 1, j);
+        else darrswap(arr, i - 1, j);
+    }
+    double elapsed = bench_now() - start;
+    bench_sink = arr[0];
+    darrfree(arr);
+    return (double) (count - 1) / elapsed * 1e-6;
+}
+
+static void
+bench_swap(size_t count) {
+    // kept small enough to stay in cache, so the swap itself dominates
+    count = HH_MIN(count, 100000);
+    printf("swap: Fisher-Yates shuffle of %zu elements\n", count);
+    printf("  %9s  %24s  %24s\n", "elem size", "byte-wise XOR (Mswaps/s)", "hh_darrswap (Mswaps/s)");
+    static const size_t sizes[] = { 1, 4, 8, 16, 24, 32, 64, 256 };
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        double bytes = bench_swap_run(count, sizes[i], true);
+        double words = bench_swap_run(count, sizes[i], false);
+        printf("  %9zu  %24.2lf  %24.2lf\n", sizes[i], bytes, words);
+    }
+}
+
+HH_DARR_DEFINE(f64arr, double)
+
+struct bench_pose { double xyz[3], q[3]; };
+HH_DARR_DEFINE(posearr, struct bench_pose)
+
+static void
+bench_define(size_t count) {
+    // count pushes followed by count pops, repeated so short runs are measurable
+    printf("define: %zu pushes and pops, 10 rounds\n", count);
+    printf("  %-26s  %14s  %14s\n", "array", "push Mops/s", "pop Mops/s");
+    double elapsed_push, elapsed_pop, sum = 0.0;
+    struct bench_pose pose = {0};
+#define BENCH_DEFINE_RUN(label, T, push, pop) do { \
+        T* arr = NULL; \
+        elapsed_push = elapsed_pop = 0.0; \
+        for(int round = 0; round < 10; ++round) { \
+            double start = bench_now(); \
+            for(size_t i = 0; i < count; ++i) { \
+                pose.xyz[0] = (double) i; \
+                push; \
+            } \
+            elapsed_push += bench_now() - start; \
+            start = bench_now(); \
+            for(size_t i = 0; i < count; ++i) sum += pop; \
+            elapsed_pop += bench_now() - start; \
+        } \
+        darrfree(arr); \
+        printf("  %-26s  %14.2lf  %14.2lf\n", label, \
+            (double) count * 10.0 / elapsed_push * 1e-6, (double) count * 10.0 / elapsed_pop * 1e-6); \
+    } while(0)
+    BENCH_DEFINE_RUN("double, hh_darrput/pop", double, darrput(arr, pose.xyz[0]), darrpop(arr));
+    BENCH_DEFINE_RUN("double, HH_DARR_DEFINE", double, f64arr_push(&arr, pose.xyz[0]), f64arr_pop(arr));
+    BENCH_DEFINE_RUN("48-byte, hh_darrput/pop", struct bench_pose, darrput(arr, pose), darrpop(arr).xyz[0]);
+    BENCH_DEFINE_RUN("48-byte, HH_DARR_DEFINE", struct bench_pose, posearr_push(&arr, pose), posearr_pop(arr).xyz[0]);
+#undef BENCH_DEFINE_RUN
+    bench_sink = (size_t) sum;
+}
+
+// pushes per timed batch in bench_segarr
+#define SEGARR_BATCH 1024
+
+static int
+bench_cmp_double(const void* a, const void* b) {
+    double x = *((const double*) a), y = *((const double*) b);
+    return (x > y) - (x < y);
+}
+
+static void
+bench_segarr(size_t count) {
+    // push latency of count 48-byte records, measured per batch of SEGARR_BATCH pushes
+    printf("segarr: %zu pushes of 48-byte records, latency per %d pushes\n", count, SEGARR_BATCH);
+    printf("  %-14s  %9s  %12s  %12s  %12s  %14s\n", "array", "seconds", "median (us)", "p99.9 (us)", "max (us)", "relocated MiB");
+    size_t batches = count / SEGARR_BATCH;
+    double* latency = malloc(sizeof(double) * batches);
+    ASSERT(latency != NULL, "Failed to allocate latency buffer");
+    struct bench_pose pose = {0};
+    // hh_darr with realloc, hh_darr with a copying allocator, then hh_segarr
+    static const char* labels[] = { "hh_darr", "hh_darr (copy)", "hh_segarr" };
+    for(int run = 0; run < 3; ++run) {
+        bool segmented = (run == 2);
+        struct bench_pose* arr = NULL, ** segs = NULL;
+        bench_grow_state.copy = (run == 1);
+        bench_grow_state.relocated = 0;
+        double start = bench_now(), elapsed = 0.0;
+        for(size_t b = 0; b < batches; ++b) {
+            double start_batch = bench_now();
+            for(size_t i = 0; i < SEGARR_BATCH; ++i) {
+                pose.xyz[0] = (double) i;
+                if(segmented) segarrput(segs, pose);
+                else darrput(arr, pose);
+            }
+            latency[b] = (bench_now() - start_batch) * 1e6;
+        }
+        elapsed = bench_now() - start;
+        bench_sink = darrlen(arr) + segarrlen(segs);
+        darrfree(arr);
+        segarrfree(segs);
+        qsort(latency, batches, sizeof(double), bench_cmp_double);
+        bench_grow_state.copy = false;
+        printf("  %-14s  %9.3lf  %12.2lf  %12.2lf  %12.2lf  %14.1lf\n", labels[run], elapsed, 
+            latency[batches / 2], latency[batches - 1 - batches / 1000], latency[batches - 1], 
+            (double) bench_grow_state.relocated / 1048576.0);
+    }
+    free(latency);
+}
+
+static void
+bench_open(size_t count) {
+    // builds count 8-byte elements in a file-backed array, then reopens and scans it
+    const char* path = PROJECT_ROOT "/examples/hh_darr_bench.bin";
+    remove(path);
+    printf("open: %zu 8-byte elements (%.1lf MiB)\n", count, (double) count * 8.0 / 1048576.0);
+    uint64_t* heap = NULL, * mapped = NULL, sum = 0;
+    double start = bench_now();
+    for(uint64_t i = 0; i < count; ++i) darrput(heap, i);
+    double elapsed_heap = bench_now() - start;
+    darrfree(heap);
+    start = bench_now();
+    ASSERT(darropen(mapped, path), "hh_darropen failed: path = %s", path);
+    for(uint64_t i = 0; i < count; ++i) darrput(mapped, i);
+    double elapsed_build = bench_now() - start;
+    start = bench_now();
+    ASSERT(darrsync(mapped), "hh_darrsync failed");
+    double elapsed_sync = bench_now() - start;
+    start = bench_now();
+    darrfree(mapped);
+    double elapsed_close = bench_now() - start;
+    start = bench_now();
+    ASSERT(darropen(mapped, path) && darrlen(mapped) == count, "hh_darropen failed to reopen: path = %s", path);
+    double elapsed_open = bench_now() - start;
+    start = bench_now();
+    for(size_t i = 0; i < darrlen(mapped); ++i) sum += mapped[i];
+    double elapsed_scan = bench_now() - start;
+    ASSERT(sum == (uint64_t) count * (count - 1) / 2, "Scan of reopened array returned incorrect sum");
+    darrfree(mapped);
+    remove(path);
+    printf("  hh_darrput, heap:           %8.3lfs\n", elapsed_heap);
+    printf("  hh_darrput, file-backed:    %8.3lfs\n", elapsed_build);
+    printf("  hh_darrsync:                %8.3lfs\n", elapsed_sync);
+    printf("  hh_darrfree (trim, close):  %8.3lfs\n", elapsed_close);
+    printf("  hh_darropen (reopen):       %8.6lfs\n", elapsed_open);
+    printf("  scan after reopen:          %8.3lfs\n", elapsed_scan);
+}
+
+static void
+bench_inline(size_t count) {
+    // count short-lived requests, each collecting a handful of 4-byte ids
+    printf("inline: %zu requests of 4-byte ids, inline capacity 16\n", count);
+    printf("  %-16s  %-16s  %9s  %10s  %12s\n", "workload", "array", "seconds", "mallocs", "ns/request");
+    for(int run = 0; run < 4; ++run) {
+        // small requests fit in the inline storage; mixed overflows it every 64th request
+        bool mixed = (run >= 2), inl = (run % 2 == 1);
+        bench_grow_state.mallocs = 0;
+        size_t total = 0;
+        double start = bench_now();
+        for(size_t r = 0; r < count; ++r) {
+            uint32_t n = (mixed && r % 64 == 0) ? 24 : (uint32_t) (r % 12) + 1;
+            if(inl) {
+                DARR_INLINE(uint32_t, ids, 16);
+                for(uint32_t i = 0; i < n; ++i) darrput(ids, i);
+                total += darrlen(ids);
+                darrfree(ids);
+            } else {
+                uint32_t* ids = NULL;
+                for(uint32_t i = 0; i < n; ++i) darrput(ids, i);
+                total += darrlen(ids);
+                darrfree(ids);
+            }
+        }
+        double elapsed = bench_now() - start;
+        bench_sink = total;
+        printf("  %-16s  %-16s  %9.3lf  %10zu  %12.1lf\n", mixed ? "1-12, 1/64 of 24" : "1-12 ids", 
+            inl ? "HH_DARR_INLINE" : "hh_darr", elapsed, bench_grow_state.mallocs, elapsed * 1e9 / (double) count);
+    }
+}
+
+// grows an array to count elements in a child process, so each run reports its own peak RSS
+// on Windows, runs share the process and peak RSS isn't reported
+static void
+bench_grow_run(const char* label, size_t count) {
+    fflush(stdout);
+#ifndef _WIN32
+    pid_t pid = fork();
+    ASSERT(pid >= 0, "fork failed");
+    if(pid > 0) {
+        waitpid(pid, NULL, 0);
+        return;
+    }
+#endif // _WIN32
+    bench_grow_state.reallocs = bench_grow_state.relocated = 0;
+    uint32_t* arr = NULL;
+    double start = bench_now();
+    for(uint32_t i = 0; i < (uint32_t) count; ++i) darrput(arr, i);
+    double elapsed = bench_now() - start;
+    char rss[32] = "-";
+#ifndef _WIN32
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    snprintf(rss, sizeof(rss), "%.1lf", (double) usage.ru_maxrss / 1024.0);
+#endif // _WIN32
+    printf("  %-22s  %8zu  %14.1lf  %12.1lf  %9.3lf  %13s\n", label, 
+        bench_grow_state.reallocs, (double) bench_grow_state.relocated / 1048576.0, 
+        (double) darrcap(arr) * sizeof(uint32_t) / 1048576.0, elapsed, rss);
+    fflush(stdout);
+    darrfree(arr);
+#ifndef _WIN32
+    _exit(0);
+#endif // _WIN32
+}
+
+static void
+bench_grow(size_t count) {
+    printf("grow: hh_darrput of %zu 4-byte elements (%.1lf MiB)\n", count, (double) count * 4.0 / 1048576.0);
+    printf("  %-22s  %8s  %14s  %12s  %9s  %13s\n", 
+        "policy", "reallocs", "relocated MiB", "final cap MiB", "seconds", "peak RSS MiB");
+    static const struct { const char* label; int policy; bool copy; } runs[] = {
+        { "2x, realloc", GROW_DOUBLE, false },
+        { "1.5x, realloc", GROW_HALF, false },
+        { "1.5x pages, realloc", GROW_HALF_PAGES, false },
+        { "2x, malloc + memcpy", GROW_DOUBLE, true },
+        { "1.5x, malloc + memcpy", GROW_HALF, true },
+    };
+    for(size_t i = 0; i < sizeof(runs) / sizeof(*runs); ++i) {
+        bench_grow_state.policy = runs[i].policy;
+        bench_grow_state.copy = runs[i].copy;
+        bench_grow_run(runs[i].label, count);
+    }
+    bench_grow_state.policy = GROW_DOUBLE;
+    bench_grow_state.copy = false;
+}
+
+int
+main(int argc, char* argv[]) {
+    const char* name = (argc > 1) ? argv[1] : NULL;
+    size_t count = (argc > 2) ? strtoul(argv[2], NULL, 10) : 2000000;
+    bool any = false;
+#define BENCH(bench) if(name == NULL || strcmp(name, #bench) == 0) { any = true; bench_##bench(count); }
+    BENCH(append);
+    BENCH(grow);
+    BENCH(swap);
+    BENCH(define);
+    BENCH(segarr);
+    BENCH(open);
+    BENCH(inline);
+#undef BENCH
+    if(!any) {
+        ERR("Unrecognized benchmark: %s", name);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,399 @@
+#define HH_IMPLEMENTATION
+#define HH_STRIP_PREFIXES
+#define HH_MAP_THREADS
+#include "h.h"
+
+#include <stdbool.h>
+#include <time.h>
+// the concurrent benchmark drives its readers with pthreads
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif // _WIN32
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#include <malloc.h>
+#define BENCH_MALLINFO
+#endif
+
+// benchmarks for hh_map_t
+// usage: ./hh_map_bench [benchmark] [count]
+// runs every benchmark when none is given
+
+HH_MAP_DEFINE(u64map, uint64_t, double)
+
+static double
+bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+}
+
+// splitmix64, used to generate keys
+static uint64_t
+bench_rand(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+// fills a map with count random 8-byte keys and returns the keys in a shuffled order
+static uint64_t*
+bench_fill(map_t* map, size_t count) {
+    uint64_t state = 42, * keys = NULL;
+    for(size_t i = 0; i < count; ++i) {
+        uint64_t key = bench_rand(&state);
+        map_insert(map, &key, sizeof(key), &i, sizeof(i));
+        darrput(keys, key);
+    }
+    for(size_t i = count; i > 1; --i) darrswap(keys, i - 1, (size_t) (bench_rand(&state) % i));
+    return keys;
+}
+
+static void
+bench_get_many(size_t count) {
+    map_t map = {0};
+    uint64_t* keys = bench_fill(&map, count);
+    // the same lookups, once as a loop of hh_map_get and once in batches
+    size_t found = 0;
+    double start = bench_now();
+    for(size_t i = 0; i < count; ++i) found += map_get(&map, &keys[i], sizeof(uint64_t)).val != NULL;
+    double elapsed_get = bench_now() - start;
+    ASSERT(found == count, "hh_map_get missed %zu keys", count - found);
+    const void* ptrs[256];
+    size_t sizes[256];
+    map_entry_t entries[256];
+    for(size_t i = 0; i < ARR_LEN(sizes); ++i) sizes[i] = sizeof(uint64_t);
+    found = 0;
+    start = bench_now();
+    for(size_t i = 0, n; i < count; i += n) {
+        n = MIN(count - i, ARR_LEN(ptrs));
+        for(size_t j = 0; j < n; ++j) ptrs[j] = &keys[i + j];
+        found += map_get_many(&map, ptrs, sizes, n, entries);
+    }
+    double elapsed_many = bench_now() - start;
+    ASSERT(found == count, "hh_map_get_many missed %zu keys", count - found);
+    printf("get_many: %zu keys\n", count);
+    printf("  hh_map_get loop: %8.2lf Mops/s\n", (double) count / elapsed_get * 1e-6);
+    printf("  hh_map_get_many: %8.2lf Mops/s (%.2lfx)\n", 
+        (double) count / elapsed_many * 1e-6, elapsed_get / elapsed_many);
+    darrfree(keys);
+    map_free(&map);
+}
+
+static size_t
+bench_varint_size(size_t val) {
+    size_t size = 1;
+    while(val >>= 7) ++size;
+    return size;
+}
+
+// bytes requested from malloc by the table and entries of a map (allocator overhead excluded)
+static size_t
+bench_map_bytes(const map_t* map) {
+    size_t bytes = map->bucket_count * (1 + sizeof(char*));
+    map_it(map, it) {
+        bytes += it.size_key + it.size_val + sizeof(size_t);
+        bytes += map->compact ? bench_varint_size(it.size_key) + bench_varint_size(it.size_val) : sizeof(size_t) * 2;
+    }
+    return bytes;
+}
+
+// bytes of heap in use, including allocator overhead (0 if unknown)
+static size_t
+bench_heap_bytes(void) {
+#ifdef BENCH_MALLINFO
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// 4-byte keys and 8-byte values, with and without compact entries
+static void
+bench_memory(size_t count) {
+    printf("memory: %zu entries, 4-byte keys, 8-byte values\n", count);
+    printf("  %-8s  %16s  %16s\n", "layout", "requested B/key", "heap B/key");
+    for(int compact = 0; compact < 2; ++compact) {
+        size_t heap = bench_heap_bytes();
+        map_t map = { .compact = (_Bool) compact };
+        for(uint32_t i = 0; i < (uint32_t) count; ++i) {
+            uint64_t val = i;
+            map_insert(&map, &i, sizeof(i), &val, sizeof(val));
+        }
+        heap = bench_heap_bytes() - heap;
+        printf("  %-8s  %16.2lf  ", compact ? "compact" : "default", (double) bench_map_bytes(&map) / (double) count);
+        if(heap > 0) printf("%16.2lf\n", (double) heap / (double) count);
+        else printf("%16s\n", "n/a");
+        map_free(&map);
+    }
+}
+
+static void
+bench_set(size_t count) {
+    // membership through an hh_map_t with empty values vs. an hh_set_t
+    printf("set: %zu 8-byte members\n", count);
+    printf("  %-28s  %10s  %10s  %10s\n", "container", "heap B/key", "add Mops/s", "has Mops/s");
+    for(int as_set = 0; as_set < 2; ++as_set) {
+        uint64_t state = 42;
+        size_t heap = bench_heap_bytes(), found = 0;
+        map_t map = {0};
+        set_t set = {0};
+        double start = bench_now();
+        for(size_t i = 0; i < count; ++i) {
+            uint64_t key = bench_rand(&state);
+            if(as_set) set_add(&set, &key, sizeof(key));
+            else map_insert(&map, &key, sizeof(key), NULL, 0);
+        }
+        double elapsed_add = bench_now() - start;
+        heap = bench_heap_bytes() - heap;
+        state = 42;
+        start = bench_now();
+        for(size_t i = 0; i < count; ++i) {
+            uint64_t key = bench_rand(&state);
+            found += as_set ? set_has(&set, &key, sizeof(key)) : (map_get(&map, &key, sizeof(key)).key != NULL);
+        }
+        double elapsed_has = bench_now() - start;
+        ASSERT(found == count, "Membership test missed %zu keys", count - found);
+        printf("  %-28s  ", as_set ? "hh_set_t" : "hh_map_t (val = NULL, 0)");
+        if(heap > 0) printf("%10.2lf  ", (double) heap / (double) count);
+        else printf("%10s  ", "n/a");
+        printf("%10.2lf  %10.2lf\n", (double) count / elapsed_add * 1e-6, (double) count / elapsed_has * 1e-6);
+        map_free(&map);
+        set_free(&set);
+    }
+}
+
+static void
+bench_freeze(size_t count) {
+    map_t map = {0};
+    uint64_t* keys = bench_fill(&map, count);
+    map_frozen_t frozen;
+    double start = bench_now();
+    ASSERT(map_freeze(&map, &frozen), "hh_map_freeze failed");
+    double elapsed_freeze = bench_now() - start;
+    size_t found = 0;
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) found += map_get(&map, &keys[i], sizeof(uint64_t)).val != NULL;
+    double elapsed_get = bench_now() - start;
+    ASSERT(found == count, "hh_map_get missed %zu keys", count - found);
+    found = 0;
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) found += map_frozen_get(&frozen, &keys[i], sizeof(uint64_t)).val != NULL;
+    double elapsed_frozen = bench_now() - start;
+    ASSERT(found == count, "hh_map_frozen_get missed %zu keys", count - found);
+    size_t bytes_map = bench_map_bytes(&map);
+    size_t bytes_frozen = frozen.bucket_count * sizeof(uint32_t) + frozen.size_data + 
+        frozen.count * (frozen.offsets32 != NULL ? sizeof(uint32_t) : sizeof(size_t));
+    printf("freeze: %zu keys, hh_map_freeze took %.3lfs\n", count, elapsed_freeze);
+    printf("  hh_map_get:        %8.2lf Mops/s, %6.2lf bytes/key (+1 malloc per key)\n", 
+        (double) count / elapsed_get * 1e-6, (double) bytes_map / (double) count);
+    printf("  hh_map_frozen_get: %8.2lf Mops/s, %6.2lf bytes/key\n", 
+        (double) count / elapsed_frozen * 1e-6, (double) bytes_frozen / (double) count);
+    darrfree(keys);
+    map_frozen_free(&frozen);
+    map_free(&map);
+}
+
+static void
+bench_snapshot(size_t count) {
+    const char* path = PROJECT_ROOT "/examples/hh_map_bench.bin";
+    map_t map = {0};
+    double start = bench_now();
+    uint64_t* keys = bench_fill(&map, count);
+    double elapsed_build = bench_now() - start;
+    start = bench_now();
+    ASSERT(map_save(&map, path), "hh_map_save failed: path = %s", path);
+    double elapsed_save = bench_now() - start;
+    map_free(&map);
+    map_frozen_t frozen;
+    start = bench_now();
+    ASSERT(map_open_mapped(path, &frozen), "hh_map_open_mapped failed: path = %s", path);
+    double elapsed_open = bench_now() - start;
+    size_t found = 0;
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) found += map_frozen_get(&frozen, &keys[i], sizeof(uint64_t)).val != NULL;
+    double elapsed_get = bench_now() - start;
+    ASSERT(found == count, "Mapped hh_map_frozen_get missed %zu keys", count - found);
+    printf("snapshot: %zu keys, %.1lf MiB on disk\n", count, (double) frozen.size_mapping / (1024.0 * 1024.0));
+    printf("  rebuild with hh_map_insert: %8.3lfs\n", elapsed_build);
+    printf("  hh_map_save:                %8.3lfs\n", elapsed_save);
+    printf("  hh_map_open_mapped:         %8.6lfs\n", elapsed_open);
+    printf("  first pass of lookups:      %8.2lf Mops/s\n", (double) count / elapsed_get * 1e-6);
+    darrfree(keys);
+    map_frozen_free(&frozen);
+    remove(path);
+}
+
+// the same 64-bit keys in a generic hh_map_t and in a map generated by HH_MAP_DEFINE
+static void
+bench_define(size_t count) {
+    uint64_t state = 42, * keys = NULL;
+    for(size_t i = 0; i < count; ++i) darrput(keys, bench_rand(&state));
+    map_t map = {0};
+    u64map_t map_typed = {0};
+    double val = 0.0, sum = 0.0, sum_typed = 0.0;
+    double start = bench_now();
+    for(size_t i = 0; i < count; ++i, val += 1.0) map_insert(&map, &keys[i], sizeof(uint64_t), &val, sizeof(val));
+    double elapsed_insert = bench_now() - start;
+    start = bench_now();
+    val = 0.0;
+    for(size_t i = 0; i < count; ++i, val += 1.0) u64map_insert(&map_typed, keys[i], val);
+    double elapsed_insert_typed = bench_now() - start;
+    for(size_t i = count; i > 1; --i) darrswap(keys, i - 1, (size_t) (bench_rand(&state) % i));
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) sum += *((const double*) map_get_val(&map, &keys[i], sizeof(uint64_t)));
+    double elapsed_get = bench_now() - start;
+    start = bench_now();
+    for(size_t i = 0; i < count; ++i) sum_typed += *u64map_get(&map_typed, keys[i]);
+    double elapsed_get_typed = bench_now() - start;
+    ASSERT(sum == sum_typed, "Maps disagree: %lf != %lf", sum, sum_typed);
+    printf("define: %zu 8-byte keys, 8-byte values\n", count);
+    printf("  %-10s  %14s  %14s\n", "", "insert Mops/s", "get Mops/s");
+    printf("  %-10s  %14.2lf  %14.2lf\n", "hh_map_t", 
+        (double) count / elapsed_insert * 1e-6, (double) count / elapsed_get * 1e-6);
+    printf("  %-10s  %14.2lf  %14.2lf\n", "u64map_t", 
+        (double) count / elapsed_insert_typed * 1e-6, (double) count / elapsed_get_typed * 1e-6);
+    darrfree(keys);
+    u64map_free(&map_typed);
+    map_free(&map);
+}
+
+// online processors, the upper bound on thread counts below
+static long
+bench_cores(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (long) info.dwNumberOfProcessors;
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
+#endif // _WIN32
+}
+
+// sequential insertion against hh_map_build at increasing thread counts
+static void
+bench_build(size_t count) {
+    uint64_t state = 42, * keys = NULL;
+    for(size_t i = 0; i < count; ++i) darrput(keys, bench_rand(&state));
+    map_entry_t* entries = calloc(count, sizeof(map_entry_t));
+    ASSERT(entries != NULL, "Failed to allocate");
+    for(size_t i = 0; i < count; ++i) entries[i] = (map_entry_t) { sizeof(uint64_t), sizeof(uint64_t), &keys[i], &keys[i] };
+    map_t map = {0};
+    double start = bench_now();
+    for(size_t i = 0; i < count; ++i) map_insert_entry(&map, &entries[i]);
+    double elapsed_insert = bench_now() - start;
+    map_free(&map);
+    long cores = bench_cores();
+    printf("build: %zu 8-byte keys, %ld cores\n", count, cores);
+    printf("  hh_map_insert loop:        %8.2lf Mops/s\n", (double) count / elapsed_insert * 1e-6);
+    for(size_t threads = 1; threads <= (size_t) MAX(cores, 1); threads *= 2) {
+        map = (map_t) {0};
+        start = bench_now();
+        ASSERT(map_build(&map, entries, count, threads), "hh_map_build failed");
+        double elapsed = bench_now() - start;
+        ASSERT(map.count == count, "hh_map_build lost entries: count = %zu", map.count);
+        printf("  hh_map_build (%3zu threads): %8.2lf Mops/s\n", threads, (double) count / elapsed * 1e-6);
+        map_free(&map);
+    }
+    free(entries);
+    darrfree(keys);
+}
+
+#ifndef _WIN32
+#define CONCURRENT_READS (1 << 21)
+
+struct concurrent_ctx {
+    map_concurrent_t* map;
+    map_t* map_locked;
+    pthread_mutex_t* mutex;
+    const uint64_t* keys;
+    size_t count, offset;
+};
+
+static void*
+bench_concurrent_reader(void* arg) {
+    struct concurrent_ctx* ctx = arg;
+    size_t val, found = 0;
+    for(size_t i = 0; i < CONCURRENT_READS; ++i) {
+        const uint64_t* key = &ctx->keys[(ctx->offset + i) % ctx->count];
+        if(ctx->map != NULL) {
+            found += map_concurrent_get(ctx->map, key, sizeof(uint64_t), &val, sizeof(val));
+        } else {
+            pthread_mutex_lock(ctx->mutex);
+            found += map_get(ctx->map_locked, key, sizeof(uint64_t)).val != NULL;
+            pthread_mutex_unlock(ctx->mutex);
+        }
+    }
+    ASSERT(found == CONCURRENT_READS, "Reader missed %zu keys", CONCURRENT_READS - found);
+    return NULL;
+}
+
+// runs CONCURRENT_READS lookups on each of thread_count threads, returns Mops/s
+static double
+bench_concurrent_run(struct concurrent_ctx ctx, size_t thread_count) {
+    pthread_t* threads = calloc(thread_count, sizeof(pthread_t));
+    struct concurrent_ctx* ctxs = calloc(thread_count, sizeof(struct concurrent_ctx));
+    ASSERT(threads != NULL && ctxs != NULL, "Failed to allocate threads");
+    double start = bench_now();
+    for(size_t i = 0; i < thread_count; ++i) {
+        ctxs[i] = ctx;
+        ctxs[i].offset = i * (ctx.count / thread_count);
+        pthread_create(&threads[i], NULL, bench_concurrent_reader, &ctxs[i]);
+    }
+    for(size_t i = 0; i < thread_count; ++i) pthread_join(threads[i], NULL);
+    double elapsed = bench_now() - start;
+    free(threads);
+    free(ctxs);
+    return (double) (CONCURRENT_READS * thread_count) / elapsed * 1e-6;
+}
+
+static void
+bench_concurrent(size_t count) {
+    // the same keys in a sharded map and in a single map behind one mutex
+    map_concurrent_t map = {0};
+    ASSERT(map_concurrent_init(&map), "hh_map_concurrent_init failed");
+    map_t map_locked = {0};
+    uint64_t* keys = bench_fill(&map_locked, count);
+    for(size_t i = 0; i < count; ++i) map_concurrent_insert(&map, &keys[i], sizeof(uint64_t), &i, sizeof(i));
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    long cores = bench_cores();
+    printf("concurrent: %zu keys, %d reads per thread, %ld cores\n", count, CONCURRENT_READS, cores);
+    printf("  threads  hh_map_concurrent_t (Mops/s)  hh_map_t + mutex (Mops/s)\n");
+    for(size_t threads = 1; threads <= (size_t) MAX(cores, 1); threads *= 2) {
+        double sharded = bench_concurrent_run((struct concurrent_ctx) { 
+            .map = &map, .keys = keys, .count = count }, threads);
+        double locked = bench_concurrent_run((struct concurrent_ctx) { 
+            .map_locked = &map_locked, .mutex = &mutex, .keys = keys, .count = count }, threads);
+        printf("  %7zu  %28.2lf  %25.2lf\n", threads, sharded, locked);
+    }
+    darrfree(keys);
+    map_free(&map_locked);
+    map_concurrent_free(&map);
+}
+#endif // _WIN32
+
+int
+main(int argc, char* argv[]) {
+    const char* name = (argc > 1) ? argv[1] : NULL;
+    size_t count = (argc > 2) ? strtoul(argv[2], NULL, 10) : 2000000;
+    bool any = false;
+#define BENCH(bench) if(name == NULL || strcmp(name, #bench) == 0) { any = true; bench_##bench(count); }
+    BENCH(get_many);
+#ifndef _WIN32
+    BENCH(concurrent);
+#endif // _WIN32
+    BENCH(freeze);
+    BENCH(snapshot);
+    BENCH(memory);
+    BENCH(set);
+    BENCH(define);
+    BENCH(build);
+#undef BENCH
+    if(!any) {
+        ERR("Unrecognized benchmark: %s", name);
+        return 1;
+    }
+    return 0;
+}
@@ -31,6 +31,10 @@ main(int argc, char* argv[]) {
     map_insert_with_cstr_key(&op_map, "insert", &fp_wrap(op_insert), sizeof(fp_wrap_t));
     map_insert_with_cstr_key(&op_map, "remove", &fp_wrap(op_remove), sizeof(fp_wrap_t));
     map_insert_with_cstr_key(&op_map, "get",    &fp_wrap(op_get), sizeof(fp_wrap_t));
+    // the commands never change, so lookups go through a frozen copy
+    map_frozen_t ops;
+    ASSERT(map_freeze(&op_map, &ops), "Failed to freeze map of commands");
+    map_free(&op_map);
     // print usage
     printf("Usage:\n");
     printf("  > insert: <key>, <value>\n");
@@ -57,18 +61,22 @@ main(int argc, char* argv[]) {
             continue;
         }
         // retrieve command from hashmap
-        op_f op = fp_unwrap(map_get_val(&op_map, token.ptr, span_len(token)), op_f);
-        if(op == NULL) {
+        const void* op_val = map_frozen_get_val(&ops, token.ptr, span_len(token));
+        if(op_val == NULL) {
             ERR("Unrecognized command: " span_fmt " [%zu]", span_fmt_args(token), span_len(token));
             continue;
         }
+        // frozen values aren't aligned, so the wrapper is copied out before unwrapping
+        fp_wrap_t op_wrap;
+        memcpy(&op_wrap, op_val, sizeof(op_wrap));
+        op_f op = fp_unwrap(&op_wrap, op_f);
         // execute the corresponding command
         if(!(op)(&cstr2cstr, &line)) continue;
         // print current state of cstr2cstr
         cstr2cstr_dump_keys(&cstr2cstr);
         cstr2cstr_dump_buckets(&cstr2cstr);
     }
-    map_free(&op_map);
+    map_frozen_free(&ops);
     map_free(&cstr2cstr);
     return 0;
 }
@@ -142,18 +150,17 @@ cstr2cstr_dump_keys(const map_t* map) {
 
 void
 cstr2cstr_dump_buckets(const map_t* map) {
-    printf("buckets:\n");
+    printf("slots:\n");
     map_entry_t entry;
     for(size_t i = 0; i < map->bucket_count; ++i) {
-        printf("%zu: ", i);
-        for(size_t j = 0; j < darrlen(map->buckets[i]);) {
-            entry.size_key = *((size_t*) (map->buckets[i] + j)); j += sizeof(size_t);
-            if(entry.size_key == 0) break;
-            entry.size_val = *((size_t*) (map->buckets[i] + j)); j += sizeof(size_t);
-            entry.key = map->buckets[i] + j; j += entry.size_key;
-            entry.val = map->buckets[i] + j; j += entry.size_val;
-            printf("(%.*s, %.*s), ", (int) entry.size_key, (char*) entry.key, (int) entry.size_val, (char*) entry.val);
-		}
-		printf("\n");
-	}
+        // skip empty and deleted slots
+        if(map->ctrl[i] & 0x80) continue;
+        // entries are laid out as [hash, size_key, size_val, key, val]
+        entry.size_key = *((size_t*) map->slots[i] + 1);
+        entry.size_val = *((size_t*) map->slots[i] + 2);
+        entry.key = (size_t*) map->slots[i] + 3;
+        entry.val = (char*) entry.key + entry.size_key;
+        printf("%zu [0x%02x]: (%.*s, %.*s)\n", i, (unsigned) map->ctrl[i], 
+            (int) entry.size_key, (char*) entry.key, (int) entry.size_val, (char*) entry.val);
+    }
 }
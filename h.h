@@ -16,6 +16,9 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <assert.h>
+// used by the functions HH_MAP_DEFINE generates
+#include <stdlib.h>
+#include <string.h>
 
 // log only errors
 // #define HH_LOG HH_LOG_ERR
@@ -158,6 +161,24 @@ typedef union {
 // Adapted from...
 // stb_ds.h - v0.67 - public domain data structures - Sean Barrett 2019
 
+// dynamic arrays allocate through HH_DARR_REALLOC and HH_DARR_FREE,
+// define both before including h.h to draw from a custom allocator (arena, pool, etc.)
+#ifndef HH_DARR_REALLOC
+#define HH_DARR_REALLOC(ptr, size) realloc((ptr), (size))
+#endif // HH_DARR_REALLOC
+#ifndef HH_DARR_FREE
+#define HH_DARR_FREE(ptr) free(ptr)
+#endif // HH_DARR_FREE
+
+// returns the capacity an array of cap elements grows to when it must hold min_cap,
+// the result must be >= min_cap, cap is 0 when the array is allocated
+// the default doubles the capacity (starting from HH_ARR_CAP_DEFAULT)
+// 1.5x growth, for example:
+// #define HH_DARR_GROW(cap, min_cap, elem_size) HH_MAX((cap) + (cap) / 2, (min_cap))
+#ifndef HH_DARR_GROW
+#define HH_DARR_GROW(cap, min_cap, elem_size) HH__darrgrowcap((cap), (min_cap))
+#endif // HH_DARR_GROW
+
 // hh_darrclear    sets array length to 0
 // hh_darrfree     frees the array and sets it to NULL
 // hh_darrlast     returns the last element by value
@@ -165,33 +186,150 @@ typedef union {
 // hh_darrputstr   pushes a string to a char* dynamic array (always ensures null-termination)
 // hh_darrpop      removes the last element and returns it by value
 // hh_darradd      adds n zero-initialized elements to the array, returns the index to the 1st new element
+// hh_darraddn_uninit adds n uninitialized elements to the array, returns the index to the 1st new element
+// hh_darrputn     appends n elements copied from ptr (which may point into arr), returns the index to the 1st new element
+// hh_darrreserve  ensures capacity for n elements without changing length, returns capacity
+// hh_darrshrink   shrinks capacity to the array's length, returns capacity
 // hh_darrlen      returns array length
 // hh_darrcap      returns array capacity
 // hh_darrswap     swaps the elements at 2 indices
 // hh_darrswapdel  deletes the ith element by swapping ot with the last element, then popping
+// hh_darrinsert   inserts a value at index i, shifting later elements up, returns i
+// hh_darrdel      deletes the ith element, shifting later elements down
+// hh_darrdelrange deletes n elements starting at index i, shifting later elements down
+// hh_darropen     backs an array (which must be NULL) with the file at path, returns truthy on success
+// hh_darrsync     flushes a file-backed array to disk, returns truthy on success
 
 #define hh_darrclear(arr)      ((arr == NULL) ? 0 : (hh_darrheader(arr)->len = 0))
-#define hh_darrfree(arr)       ((void) ((arr == NULL) ? (void) 0 : free(hh_darrheader(arr))), (arr) = NULL)
+#define hh_darrfree(arr)       (HH__darrfree(arr), (arr) = NULL)
 #define hh_darrlast(arr)       ((arr)[hh_darrheader(arr)->len - 1])
 #define hh_darrput(arr, val)   ((void) hh_darrgrow(arr, 1), (arr)[(hh_darrheader(arr)->len)++] = (val))
 #define hh_darrpop(arr)        ((arr)[--(hh_darrheader(arr)->len)])
 #define hh_darradd(arr, n)     (HH__darradd((void**) &(arr), (n), sizeof *(arr)))
+#define hh_darraddn_uninit(arr, n) (HH__darraddn_uninit((void**) &(arr), (n), sizeof *(arr)))
+#define hh_darrputn(arr, ptr, n) (HH__darrputn((void**) &(arr), (ptr), (n), sizeof *(arr)))
+#define hh_darrreserve(arr, n) (HH__darrreserve((void**) &(arr), (n), sizeof *(arr)))
+#define hh_darrshrink(arr)     (HH__darrshrink((void**) &(arr)))
 #define hh_darrlen(arr)        ((arr == NULL) ? 0 : hh_darrheader(arr)->len)
 #define hh_darrcap(arr)        ((arr == NULL) ? 0 : hh_darrheader(arr)->cap)
 #define hh_darrswap(arr, i, j) (HH__darrswap((arr), (i), (j)))
 #define hh_darrswapdel(arr, i) (HH__darrswap((arr), (i), hh_darrlen(arr) - 1), hh_darrpop(arr))
- 
-// TODO: hh_darrputstr should be an expression macro as above,
-// even if it requires a helper function
-
-// append a string to a dynamic array
-// ensures null-termination
-#define hh_darrputstr(arr, str) do { \
-        if(hh_darrlen(arr) == 0 || (hh_darrlen(arr) != 0 && hh_darrlast(arr) != '\0')) hh_darrput(arr, '\0'); \
-        assert(hh_darrlast(arr) == '\0'); \
-        size_t _tmp = hh_darradd(arr, strlen(str)) - 1; \
-        strcpy((arr) + _tmp, (str)); \
-    } while(0)
+// the value is staged at the end of the array, so i is only evaluated once (before the length changes)
+// and the array grows exactly when hh_darrput would
+#define hh_darrinsert(arr, i, val) ((void) hh_darrgrow(arr, 1), (arr)[hh_darrheader(arr)->len] = (val), HH__darrinsert((arr), (i)))
+#define hh_darrdel(arr, i)     (HH__darrdelrange((arr), (i), 1))
+#define hh_darrdelrange(arr, i, n) (HH__darrdelrange((arr), (i), (n)))
+#define hh_darropen(arr, path) (HH__darropen((void**) &(arr), (path), sizeof *(arr)))
+#define hh_darrsync(arr)       (HH__darrsync(arr))
+
+// declares `T* name`, a dynamic array that starts out in n elements of automatic (stack) storage
+// once it outgrows them, its elements move to the heap and it behaves like any other dynamic array,
+// so short temporary arrays never allocate, every hh_darr* operation accepts them,
+// and hh_darrfree only frees what was spilled (the storage itself must outlive the array)
+// example:
+// HH_DARR_INLINE(int, stack, 16);
+// for(int i = 0; i < 10; ++i) hh_darrput(stack, i);
+// hh_darrfree(stack);
+// NOTE: T must not be aligned more strictly than size_t, otherwise the declaration fails to compile
+// (the header must immediately precede the elements, as it does on the heap)
+#define HH_DARR_INLINE(T, name, n) \
+    struct name##__inline_t { hh_darrheader_t hdr; T elems[n]; } name##__inline; \
+    T* name = HH__darrinline(&name##__inline.hdr, name##__inline.elems, (n), \
+        sizeof(T) + 0 * sizeof(char[offsetof(struct name##__inline_t, elems) == sizeof(hh_darrheader_t) ? 1 : -1]))
+
+// file-backed dynamic arrays
+// hh_darropen maps the file at path (creating it if it doesn't exist) and restores its elements,
+// the file holds a small header, the array's header, then its elements,
+// so every hh_darr macro keeps working, and growth extends the file and maps it again
+// rather than copying elements (the kernel pages them in and out on demand)
+// writes reach the page cache immediately, hh_darrsync waits until they reach the disk
+// hh_darrfree trims the file to the array's length, unmaps it and closes it
+// NOTE: the file is trusted beyond its header, and only opens with the element size it was created with
+// NOTE: the array's address changes when it grows, just like a heap-allocated array
+// example:
+// double* samples = NULL;
+// if(!hh_darropen(samples, "samples.bin")) ...
+// hh_darrput(samples, 1.5);
+// hh_darrfree(samples);
+
+// append a string to a dynamic array, overwriting its null-terminator (if present)
+// ensures null-termination, returns the index of the string's 1st character
+#define hh_darrputstr(arr, str) (HH__darrputstr(&(arr), (str)))
+
+// generator for dynamic arrays with a compile-time element size
+// HH_DARR_DEFINE(name, T) emits the following, where every function is static:
+// name_t                                         T*, initialize it to NULL
+// void   name_push(name_t* arr, T val)           append a value
+// T      name_pop(name_t arr)                    remove the last element and return it
+// void   name_insert(name_t* arr, size_t i, T val)
+//                                                insert a value at index i, shifting later elements up
+// size_t name_reserve(name_t* arr, size_t n)     like hh_darrreserve, returns capacity
+// T*     name_at(name_t arr, size_t i)           pointer to the ith element (bounds-checked by HH_ASSERT)
+// the fast paths are inlined with sizeof(T) known, growth still goes through HH__darrgrow,
+// the arrays share hh_darrheader_t with the generic ones, so every hh_darr* macro accepts them
+// example:
+// HH_DARR_DEFINE(f64arr, double)
+// f64arr_t arr = NULL;
+// f64arr_push(&arr, 1.5);
+// for(size_t i = 0; i < hh_darrlen(arr); ++i) ...
+// hh_darrfree(arr);
+#define HH_DARR_DEFINE(name, T) \
+    typedef T* name##_t; \
+    static HH_UNUSED void \
+    name##_push(name##_t* arr, T val) { \
+        if(*arr == NULL || hh_darrheader(*arr)->len == hh_darrheader(*arr)->cap) \
+            HH__darrgrow((void**) arr, 1, sizeof(T)); \
+        hh_darrheader_t* arr_hdr = hh_darrheader(*arr); \
+        (*arr)[arr_hdr->len++] = val; \
+    } \
+    static HH_UNUSED T \
+    name##_pop(name##_t arr) { \
+        HH_ASSERT(hh_darrlen(arr) > 0, #name "_pop received array with 0 elements"); \
+        return arr[--(hh_darrheader(arr)->len)]; \
+    } \
+    static HH_UNUSED void \
+    name##_insert(name##_t* arr, size_t i, T val) { \
+        size_t len = hh_darrlen(*arr); \
+        HH_ASSERT(i <= len, #name "_insert received invalid index (i: %zu, len: %zu)", i, len); \
+        if(*arr == NULL || len == hh_darrheader(*arr)->cap) HH__darrgrow((void**) arr, 1, sizeof(T)); \
+        memmove(*arr + i + 1, *arr + i, (len - i) * sizeof(T)); \
+        (*arr)[i] = val; \
+        hh_darrheader(*arr)->len = len + 1; \
+    } \
+    static HH_UNUSED size_t \
+    name##_reserve(name##_t* arr, size_t n) { \
+        return HH__darrreserve((void**) arr, n, sizeof(T)); \
+    } \
+    static HH_UNUSED T* \
+    name##_at(name##_t arr, size_t i) { \
+        HH_ASSERT(i < hh_darrlen(arr), #name "_at received invalid index (i: %zu, len: %zu)", i, hh_darrlen(arr)); \
+        return arr + i; \
+    }
+
+// segmented dynamic array, a NULL-initialized T** (e.g. `struct pose** poses = NULL;`)
+// elements live in segments that double in size, the first holding 2^HH_SEGARR_BASE_BITS elements,
+// so growing never copies or moves elements, and pointers to them remain valid until hh_segarrfree
+// indexing takes a couple of shifts and a bit scan
+// the segments and their table are allocated through HH_DARR_REALLOC and HH_DARR_FREE
+// hh_segarrclear  sets array length to 0, keeping its segments
+// hh_segarrfree   frees every segment and the array, then sets it to NULL
+// hh_segarrat     the ith element as an lvalue (NOTE: i is evaluated twice)
+// hh_segarrlast   the last element as an lvalue
+// hh_segarrput    inserts a value, returns assignment result
+// hh_segarrpop    removes the last element and returns it by value
+// hh_segarradd    adds n zero-initialized elements to the array, returns the index to the 1st new element
+// hh_segarrlen    returns array length
+// hh_segarrcap    returns array capacity (the total size of its segments)
+
+#define hh_segarrclear(arr)    ((arr == NULL) ? 0 : (hh_darrheader(arr)->len = 0))
+#define hh_segarrfree(arr)     (HH__segarrfree((void**) (arr)), (arr) = NULL)
+#define hh_segarrat(arr, i)    ((arr)[HH__segarr_seg(i)][HH__segarr_off(i)])
+#define hh_segarrlast(arr)     hh_segarrat(arr, hh_darrheader(arr)->len - 1)
+#define hh_segarrput(arr, val) ((void) HH__segarradd((void***) &(arr), 1, sizeof **(arr), 0), hh_segarrlast(arr) = (val))
+#define hh_segarrpop(arr)      (--(hh_darrheader(arr)->len), hh_segarrat(arr, hh_darrheader(arr)->len))
+#define hh_segarradd(arr, n)   (HH__segarradd((void***) &(arr), (n), sizeof **(arr), 1))
+#define hh_segarrlen(arr)      ((arr == NULL) ? 0 : hh_darrheader(arr)->len)
+#define hh_segarrcap(arr)      ((arr == NULL) ? 0 : hh_darrheader(arr)->cap)
 
 // type representing a memory arena
 typedef struct HH__arena hh_arena;
@@ -199,13 +337,38 @@ typedef struct HH__arena hh_arena;
 // allocates memory within an arena
 // assumes 0-initialization
 // any size is valid, even if it is >= HH_ARENA_DEFAULT_SIZE
+// the result is aligned to HH_ARENA_ALIGN (by default, the strictest fundamental alignment)
 void*
 hh_arena_alloc(hh_arena* arena, size_t sz);
+// allocates memory within an arena, aligned to `align` bytes
+// `align` must be a power of two
+void*
+hh_arena_alloc_aligned(hh_arena* arena, size_t sz, size_t align);
 // free the given memory arena
 // does not free(arena), it must be freed separately if it was heap-allocated
 void
 hh_arena_free(hh_arena* arena);
 
+// a position within an arena, see hh_arena_mark
+// stays valid if the arena itself is copied or moved
+typedef struct {
+    hh_arena* page; // NULL for the arena's first page
+    char* cur;
+} hh_arena_mark_t;
+
+// records the arena's current position, for use with hh_arena_rewind
+hh_arena_mark_t
+hh_arena_mark(hh_arena* arena);
+// releases everything allocated since `mark` was taken
+// pages are kept for reuse (up to HH_ARENA_RETAIN_MAX of them), not returned to malloc
+// marks taken after `mark` are invalidated
+void
+hh_arena_rewind(hh_arena* arena, hh_arena_mark_t mark);
+// releases every allocation, keeping pages for reuse like hh_arena_rewind
+// once the arena has grown to its working size, allocation never calls malloc
+void
+hh_arena_reset(hh_arena* arena);
+
 // hh_path_alloc
 // [in const] raw: a cstr representing a raw path
 // return: heap-allocated dynamic array containing the normalized path
@@ -324,7 +487,19 @@ hh_span(char* contents);
 #define hh_span_next_ld(span, err, ...) hh_span_next_opt_ld((span), (hh_span_opt) { __VA_ARGS__ }, (err))
 #define hh_span_next_zu(span, err, ...) hh_span_next_opt_zu((span), (hh_span_opt) { __VA_ARGS__ }, (err))
 
+// hashes len bytes of key, consuming up to 48 bytes per step (adapted from wyhash)
+// the seed perturbs every output, so differently seeded tables disagree on collisions
+// this is the default hashing function of hh_map_t
+uint64_t
+hh_hash_bytes(const void* key, size_t len, uint64_t seed);
+// returns a seed that differs between processes and between calls
+// not cryptographically secure, but enough to resist precomputed collision sets
+uint64_t
+hh_hash_seed_random(void);
+
 // templates for custom key hashing and comparator functions
+// NOTE: keys that compare equal must produce equal hashes,
+// hh_map_t compares stored hashes before invoking hh_map_comp_f
 typedef size_t (*hh_map_hash_f)(const void* key, size_t size_key);
 // hh_map_comp_f's return value follows the same paradigm as memcmp or strcmp
 //  0 indicates equality
@@ -340,18 +515,54 @@ typedef void (*hh_map_free_f)(const void* ptr, size_t size_ptr);
 // standard initialization:
 // hh_map_t* hm = { .bucket_count = 32, 0 };
 // NOTE: all other fields should be 0-initialized
+// the table uses open addressing: `ctrl` holds a 1-byte tag per slot
+// (7 bits of the hash, or an empty/deleted marker) which is probed
+// 16 slots at a time, while `slots` points to out-of-line entries
+// bucket_count is rounded up to a power of two (minimum 16) on first insertion
+// the table doubles whenever an insertion would push the ratio of occupied slots
+// (including tombstones left by removals) above max_load,
+// which defaults to HH_MAP_MAX_LOAD when left as 0
+// `seed` is passed to hh_hash_bytes when no custom hash is given,
+// set it to hh_hash_seed_random() for maps that store untrusted keys
+// `count` holds the number of entries and must not be modified
+// when `incremental` is set, growing only allocates the new table,
+// and every insertion or removal then moves HH_MAP_REHASH_STEP slots of the old table over,
+// which bounds the latency of each call, lookups probe both tables and never modify the map
+// when `compact` is set, each entry stores its key and value sizes as varints
+// instead of two size_t's, which saves up to 14 bytes per entry when keys and values are small
+// when `storage` is set, entries are allocated from that arena instead of with malloc,
+// they are never freed individually, so every key and value pointer handed out by the map
+// stays readable until the arena itself is freed (even after removal or overwriting)
+// the arena is owned by the caller and may be shared between maps,
+// hh_map_free does not free it
+// NOTE: incremental, compact and storage must not change after the first insertion
 typedef struct {
     size_t bucket_count;
     hh_map_hash_f hash;
     hh_map_comp_f comp;
     hh_map_free_f free_key;
     hh_map_free_f free_val;
-    char** buckets;
+    double max_load;
+    _Bool incremental;
+    _Bool compact;
+    hh_arena* storage;
+    uint64_t seed;
+    size_t count;
+    size_t deleted;
+    uint8_t* ctrl;
+    char** slots;
+    // the previous table while an incremental rehash is in progress
+    struct {
+        size_t bucket_count, count, migrated;
+        uint8_t* ctrl;
+        char** slots;
+    } old;
 } hh_map_t;
 
 // represents an element returned by hh_map_get
 // changing the data pointer to by `val` is UB
 // unless the length is preserved
+// NOTE: `key` and `val` are not aligned
 typedef struct {
     size_t size_key, size_val;
     const void* key;
@@ -369,10 +580,38 @@ hh_map_insert(hh_map_t* map, const void* key, size_t size_key, const void* val,
 // useful for copying from one hashmap to another
 _Bool
 hh_map_insert_entry(hh_map_t* map, const hh_map_entry_t* entry);
+// insert or overwrite a key-value pair, hashing and probing only once
+// an existing entry is overwritten in place when size_val is unchanged
+// val may be NULL, in which case the value is 0-initialized,
+// it may also point into the value being overwritten, even when size_val changes
+// returns a writable pointer to the stored value, NULL on failure
+// `inserted` (optional) is set truthy if the key was not already present
+// NOTE: values directly follow their keys, so the pointer is not aligned, typed values must be accessed with memcpy
+void*
+hh_map_upsert(hh_map_t* map, const void* key, size_t size_key, const void* val, size_t size_val, _Bool* inserted);
+// returns a writable pointer to the value of the given key,
+// inserting a 0-initialized value of size_val bytes if the key isn't present
+// existing values are returned untouched, regardless of their size
+// `inserted` (optional) is set truthy if the key was not already present
+// NOTE: like hh_map_upsert, the pointer is not aligned
+// example: 
+// size_t count;
+// void* val = hh_map_get_or_insert(&map, word, strlen(word), sizeof(size_t), NULL);
+// if(val != NULL) {
+//     memcpy(&count, val, sizeof(count));
+//     ++count;
+//     memcpy(val, &count, sizeof(count));
+// }
+void*
+hh_map_get_or_insert(hh_map_t* map, const void* key, size_t size_key, size_t size_val, _Bool* inserted);
 // returns the key-value pair associated with a given key
 // if the key does not exist in the map, the entry is 0-initialized
+// entries never move when other keys are inserted or removed, or when the table is rehashed,
+// so the pointers remain valid until this key is removed or overwritten with a different size_val
+// (or until the arena is freed, when `storage` is set)
 // NOTE: changing the underlying key & value data is a corrupting action
 // if the length overruns size_key or size_val, respectively
+// NOTE: lookups never modify the map, so concurrent readers of an unchanging map are safe
 hh_map_entry_t
 hh_map_get(const hh_map_t* map, const void* key, size_t size_key);
 // macro for querying with cstr keys
@@ -383,17 +622,365 @@ const void*
 hh_map_get_val(const hh_map_t* map, const void* key, size_t size_key);
 // another helper that returns the value pointer for a cstr key, instead of the entry
 #define hh_map_get_val_with_cstr_key(map, key) hh_map_get_val(map, key, strlen(key))
+// looks up n independent keys at once, writing the results to out (same rules as hh_map_get)
+// the batch is hashed up front and the table memory of each key is prefetched
+// before any of them are resolved, so cache misses overlap instead of serializing
+// returns the number of keys that were found
+size_t
+hh_map_get_many(const hh_map_t* map, const void* const* keys, const size_t* sizes, size_t n, hh_map_entry_t* out);
 // remove entry corresponding to the given key
 // returns truthy if an entry was removed
 _Bool
 hh_map_remove(hh_map_t* map, const void* key, size_t size_key);
+// grow the table so that it can hold n entries without rehashing
+// useful before bulk insertions when the final count is known
+// returns truthy on success, fails without changing the map if no table size can hold n entries
+_Bool
+hh_map_reserve(hh_map_t* map, size_t n);
+// inserts n entries at once, spreading the work across nthreads threads
+// (0 uses one thread per processor), without HH_MAP_THREADS nthreads is ignored
+// and the build runs on the calling thread
+// the result is the same as calling hh_map_insert_entry on each entry in order,
+// so later duplicates of a key overwrite earlier ones
+// entries are hashed and partitioned by their home group in parallel,
+// then each thread fills a disjoint range of the table,
+// deferring keys whose home group is already full to a short sequential pass
+// NOTE: custom hash and comp functions must be safe to call from multiple threads
+// NOTE: maps that already hold entries, or that allocate from `storage`, are filled sequentially
+// on failure, a map that started out empty is left empty (with free_key and free_val not called, 
+// since the caller still owns the entries), a sequentially filled one keeps the entries inserted before it
+// returns truthy on success
+_Bool
+hh_map_build(hh_map_t* map, const hh_map_entry_t* entries, size_t n, size_t nthreads);
+// iterator over hh_map_t
+// the leading fields mirror hh_map_entry_t and describe the current entry,
+// the remaining ones remember the slot, so each step is O(1) and never hashes
+typedef struct {
+    size_t size_key, size_val;
+    const void* key;
+    const void* val;
+    const hh_map_t* map;
+    size_t idx;
+    _Bool old;
+} hh_map_it_t;
+
 // iterator macro for hh_map
 // hh_map_it(&map, it) printf("%.*s", (int) it.size_key, it.key);
-#define hh_map_it(map, it) for(hh_map_entry_t it = HH__map_it_begin(map); it.val; HH__map_it_next(map, &it))
+// NOTE: the map must not be modified while iterating, except through hh_map_it_remove
+#define hh_map_it(map, it) for(hh_map_it_t it = HH__map_it_begin(map); it.val; HH__map_it_next(&it))
+// remove the entry the iterator currently points to, without probing
+// iteration continues with the following entry
+// the iterator's key and val pointers are invalid until it is advanced
+// NOTE: the map the iterator was created from must not be const
+void
+hh_map_it_remove(hh_map_it_t* it);
 // free hh_map_t
 void
 hh_map_free(hh_map_t* map);
 
+#ifdef HH_MAP_THREADS
+// thread-safe hashmap, only available when HH_MAP_THREADS is defined
+// keys are partitioned across shards by the high bits of their (mixed) hash,
+// each shard is an hh_map_t guarded by its own reader-writer lock,
+// so lookups only wait on writers to the same shard
+// on initialization, shard_count is rounded up to a power of two (HH_MAP_SHARD_COUNT if 0),
+// and every shard copies its configuration (bucket_count, hash, comp, etc.) from `init`
+// NOTE: incremental shards only migrate while a writer holds the shard's lock
+// NOTE: init.storage must be NULL, hh_arena is not thread-safe
+// standard initialization:
+// hh_map_concurrent_t cm = { .shard_count = 64, .init = { .bucket_count = 1024 } };
+// hh_map_concurrent_init(&cm);
+typedef struct {
+    size_t shard_count;
+    hh_map_t init;
+    size_t shard_bits;
+    struct HH__map_shard* shards;
+} hh_map_concurrent_t;
+
+// allocate the shards, must be called before the map is shared between threads
+// returns truthy on success
+_Bool
+hh_map_concurrent_init(hh_map_concurrent_t* map);
+// insert or overwrite a key-value pair, same semantics as hh_map_insert
+_Bool
+hh_map_concurrent_insert(hh_map_concurrent_t* map, const void* key, size_t size_key, const void* val, size_t size_val);
+// copies the value of the given key into val, truncated to size_val bytes
+// values are copied out because other threads may overwrite or remove the entry afterwards
+// returns truthy if the key was found
+_Bool
+hh_map_concurrent_get(const hh_map_concurrent_t* map, const void* key, size_t size_key, void* val, size_t size_val);
+// remove entry corresponding to the given key
+// returns truthy if an entry was removed
+_Bool
+hh_map_concurrent_remove(hh_map_concurrent_t* map, const void* key, size_t size_key);
+// returns the total number of entries
+// only exact when no other thread is writing
+size_t
+hh_map_concurrent_count(const hh_map_concurrent_t* map);
+// free hh_map_concurrent_t and all of its shards
+// NOTE: no other thread may be using the map
+void
+hh_map_concurrent_free(hh_map_concurrent_t* map);
+#endif // HH_MAP_THREADS
+
+// immutable hashmap for lookup tables that are built once and only read afterwards
+// produced by hh_map_freeze, which finds a minimal perfect hash (CHD) for the keys:
+// every key is assigned to a bucket of about HH_MAP_FREEZE_BUCKET_SIZE keys,
+// and each bucket stores a displacement that sends its keys to distinct slots
+// entries are packed contiguously in `data`, so a lookup costs one probe and one compare
+// each entry takes the compact layout (hash, varint sizes, key, value) without padding,
+// and is located through a 32-bit offset (`offsets32`) unless `data` reaches 4 GiB (`offsets`)
+// NOTE: keys and values are not aligned, so typed values must be read with memcpy
+// `hash`, `comp` and `seed` are copied from the source map,
+// keys and values are copied byte-for-byte, so pointers stored in them are shared
+// NOTE: all fields must be treated as read-only
+typedef struct {
+    hh_map_hash_f hash;
+    hh_map_comp_f comp;
+    uint64_t seed;
+    size_t count;
+    size_t bucket_count;
+    uint32_t* disp;
+    // exactly one of these is set when the table isn't empty
+    uint32_t* offsets32;
+    size_t* offsets;
+    char* data;
+    size_t size_data;
+    // the file mapping backing the table, if it was opened with hh_map_open_mapped
+    void* mapping;
+    size_t size_mapping;
+} hh_map_frozen_t;
+
+// builds a frozen copy of the given map, which is left untouched
+// returns truthy on success, in which case `frozen` must be freed with hh_map_frozen_free
+// fails if two distinct keys share a full hash, as no perfect hash can separate them
+_Bool
+hh_map_freeze(const hh_map_t* map, hh_map_frozen_t* frozen);
+// same semantics as hh_map_get
+hh_map_entry_t
+hh_map_frozen_get(const hh_map_frozen_t* frozen, const void* key, size_t size_key);
+#define hh_map_frozen_get_with_cstr_key(frozen, key) hh_map_frozen_get(frozen, key, strlen(key))
+// same semantics as hh_map_get_val
+const void*
+hh_map_frozen_get_val(const hh_map_frozen_t* frozen, const void* key, size_t size_key);
+#define hh_map_frozen_get_val_with_cstr_key(frozen, key) hh_map_frozen_get_val(frozen, key, strlen(key))
+// writes a frozen copy of the map to `path`, so it can be reopened without rebuilding it
+// the file is versioned, and refers to its sections by offset rather than by address
+// returns truthy on success
+_Bool
+hh_map_save(const hh_map_t* map, const char* path);
+// same as hh_map_save, for a table that is already frozen
+_Bool
+hh_map_frozen_save(const hh_map_frozen_t* frozen, const char* path);
+// maps a file written by hh_map_save into memory, read-only
+// lookups (hh_map_frozen_get) are served straight from the mapped pages,
+// so opening takes the same time for any file size,
+// and processes that open the same file share one copy in the page cache
+// fails if the file was written by a different version, or on a platform
+// with a different size_t width or byte order
+// NOTE: the file is trusted, its contents are not validated beyond the header
+// NOTE: custom hash and comp functions are not saved,
+// they must be assigned to `frozen` after opening if the source map used them
+_Bool
+hh_map_open_mapped(const char* path, hh_map_frozen_t* frozen);
+// free hh_map_frozen_t, or unmap it if it was opened with hh_map_open_mapped
+void
+hh_map_frozen_free(hh_map_frozen_t* frozen);
+
+// generator for statically typed hashmaps with fixed-size keys and values
+// HH_MAP_DEFINE(name, K, V) emits the following, where every function is static:
+// name_entry_t                                          { K key; V val; }
+// name_t                                                the map, 0-initialize it (bucket_count may be set as a hint)
+// _Bool  name_insert(name_t* map, K key, V val)         insert or overwrite, returns truthy on success
+// V*     name_get(const name_t* map, K key)             pointer to the value, NULL if the key isn't present
+// V*     name_get_or_insert(name_t* map, K key, _Bool* inserted)
+//                                                       like hh_map_get_or_insert, new values are 0-initialized
+// _Bool  name_remove(name_t* map, K key)                returns truthy if an entry was removed
+// _Bool  name_reserve(name_t* map, size_t n)            make room for n entries without rehashing
+// name_entry_t* name_next(const name_t* map, name_entry_t* entry)
+//                                                       the entry after `entry` (or the first one if NULL), NULL at the end
+// void   name_free(name_t* map)
+// entries are stored unboxed in a single array and probed linearly,
+// with the same 1-byte control tags as hh_map_t
+// hashing and comparison are inlined, by default they operate on the raw bytes of the key,
+// HH_MAP_DEFINE_WITH accepts a hash(const K*) returning size_t and an eq(const K*, const K*) instead,
+// which can be functions or function-like macros
+// NOTE: keys must not contain padding bytes unless a custom hash and eq are given
+// example:
+// HH_MAP_DEFINE(u64map, uint64_t, double)
+// u64map_t map = {0};
+// u64map_insert(&map, 42, 1.5);
+// for(u64map_entry_t* e = u64map_next(&map, NULL); e != NULL; e = u64map_next(&map, e)) ...
+#define HH_MAP_DEFINE(name, K, V) HH_MAP_DEFINE_WITH(name, K, V, HH_MAP_HASH_BYTES, HH_MAP_EQ_BYTES)
+#define HH_MAP_HASH_BYTES(key) HH__map_hash_fixed((key), sizeof(*(key)))
+#define HH_MAP_EQ_BYTES(key_a, key_b) (memcmp((key_a), (key_b), sizeof(*(key_a))) == 0)
+#define HH_MAP_DEFINE_WITH(name, K, V, hash, eq) \
+    typedef struct { K key; V val; } name##_entry_t; \
+    typedef struct { \
+        size_t bucket_count, count, deleted; \
+        uint8_t* ctrl; \
+        name##_entry_t* slots; \
+    } name##_t; \
+    static HH_UNUSED size_t \
+    name##__find(const name##_t* map, const K* key, size_t hash_key, size_t* free_idx) { \
+        size_t mask = map->bucket_count - 1, idx = (hash_key >> 7) & mask; \
+        *free_idx = SIZE_MAX; \
+        for(size_t probe = 0; probe <= mask; ++probe, idx = (idx + 1) & mask) { \
+            uint8_t ctrl = map->ctrl[idx]; \
+            if(ctrl == HH__MAP_CTRL_EMPTY) { \
+                if(*free_idx == SIZE_MAX) *free_idx = idx; \
+                return SIZE_MAX; \
+            } \
+            if(ctrl == HH__MAP_CTRL_DELETED) { \
+                if(*free_idx == SIZE_MAX) *free_idx = idx; \
+            } else if(ctrl == (uint8_t) (hash_key & 0x7F) && eq(key, &map->slots[idx].key)) return idx; \
+        } \
+        return SIZE_MAX; \
+    } \
+    static HH_UNUSED _Bool \
+    name##__resize(name##_t* map, size_t bucket_count) { \
+        /* HH__map_define_capacity returns 0 on overflow */ \
+        if(bucket_count == 0 || bucket_count > SIZE_MAX / sizeof(name##_entry_t)) return 0; \
+        uint8_t* ctrl = malloc(bucket_count); \
+        name##_entry_t* slots = malloc(sizeof(name##_entry_t) * bucket_count); \
+        if(ctrl == NULL || slots == NULL) { \
+            free(ctrl); \
+            free(slots); \
+            return 0; \
+        } \
+        memset(ctrl, HH__MAP_CTRL_EMPTY, bucket_count); \
+        size_t mask = bucket_count - 1, idx; \
+        for(size_t i = 0; map->ctrl != NULL && i < map->bucket_count; ++i) { \
+            if(map->ctrl[i] & 0x80) continue; \
+            for(idx = (hash(&map->slots[i].key) >> 7) & mask; ctrl[idx] != HH__MAP_CTRL_EMPTY; idx = (idx + 1) & mask); \
+            ctrl[idx] = map->ctrl[i]; \
+            slots[idx] = map->slots[i]; \
+        } \
+        free(map->ctrl); \
+        free(map->slots); \
+        map->bucket_count = bucket_count; \
+        map->deleted = 0; \
+        map->ctrl = ctrl; \
+        map->slots = slots; \
+        return 1; \
+    } \
+    static HH_UNUSED _Bool \
+    name##_reserve(name##_t* map, size_t n) { \
+        size_t bucket_count = HH__map_define_capacity(n); \
+        if(map->ctrl != NULL && bucket_count != 0 && bucket_count <= map->bucket_count) return 1; \
+        return name##__resize(map, bucket_count); \
+    } \
+    static HH_UNUSED V* \
+    name##_get_or_insert(name##_t* map, K key, _Bool* inserted) { \
+        if(map->ctrl == NULL && !name##_reserve(map, map->bucket_count)) return NULL; \
+        size_t hash_key = hash(&key), idx_free; \
+        size_t idx = name##__find(map, &key, hash_key, &idx_free); \
+        if(inserted != NULL) *inserted = (idx == SIZE_MAX); \
+        if(idx != SIZE_MAX) return &map->slots[idx].val; \
+        if(map->count + map->deleted + 1 > (size_t) ((double) map->bucket_count * HH_MAP_MAX_LOAD)) { \
+            /* when most occupied slots are tombstones, this rehashes without growing */ \
+            if(!name##__resize(map, HH__map_define_capacity(map->count + 1))) return NULL; \
+            name##__find(map, &key, hash_key, &idx_free); \
+        } \
+        if(map->ctrl[idx_free] == HH__MAP_CTRL_DELETED) --(map->deleted); \
+        map->ctrl[idx_free] = (uint8_t) (hash_key & 0x7F); \
+        map->slots[idx_free].key = key; \
+        memset(&map->slots[idx_free].val, 0, sizeof(V)); \
+        ++(map->count); \
+        return &map->slots[idx_free].val; \
+    } \
+    static HH_UNUSED _Bool \
+    name##_insert(name##_t* map, K key, V val) { \
+        V* ptr = name##_get_or_insert(map, key, NULL); \
+        if(ptr == NULL) return 0; \
+        *ptr = val; \
+        return 1; \
+    } \
+    static HH_UNUSED V* \
+    name##_get(const name##_t* map, K key) { \
+        if(map->ctrl == NULL) return NULL; \
+        size_t idx_free, idx = name##__find(map, &key, hash(&key), &idx_free); \
+        return (idx == SIZE_MAX) ? NULL : &map->slots[idx].val; \
+    } \
+    static HH_UNUSED _Bool \
+    name##_remove(name##_t* map, K key) { \
+        if(map->ctrl == NULL) return 0; \
+        size_t idx_free, idx = name##__find(map, &key, hash(&key), &idx_free); \
+        if(idx == SIZE_MAX) return 0; \
+        /* a slot followed by an empty one can't interrupt a probe sequence */ \
+        if(map->ctrl[(idx + 1) & (map->bucket_count - 1)] == HH__MAP_CTRL_EMPTY) { \
+            map->ctrl[idx] = HH__MAP_CTRL_EMPTY; \
+        } else { \
+            map->ctrl[idx] = HH__MAP_CTRL_DELETED; \
+            ++(map->deleted); \
+        } \
+        --(map->count); \
+        return 1; \
+    } \
+    static HH_UNUSED name##_entry_t* \
+    name##_next(const name##_t* map, name##_entry_t* entry) { \
+        size_t idx = (entry == NULL) ? 0 : (size_t) (entry - map->slots) + 1; \
+        for(; idx < map->bucket_count && map->ctrl != NULL; ++idx) \
+            if(!(map->ctrl[idx] & 0x80)) return &map->slots[idx]; \
+        return NULL; \
+    } \
+    static HH_UNUSED void \
+    name##_free(name##_t* map) { \
+        free(map->ctrl); \
+        free(map->slots); \
+        map->bucket_count = 0; \
+        map->count = 0; \
+        map->deleted = 0; \
+        map->ctrl = NULL; \
+        map->slots = NULL; \
+    }
+
+// hash set of variably-sized keys, built on hh_map_t
+// members are stored as compact hh_map_t entries without a value,
+// so each one costs its key plus a 10-byte header (hash and two 1-byte varint sizes)
+// entries are packed back to back into an arena owned by the set (or into map.storage, if the caller sets it),
+// so adding a member never calls malloc, and removed members keep their space until hh_set_free
+// `map` carries the configuration (bucket_count, hash, comp, seed, etc.) and the member count,
+// it must not be passed to hh_map_* functions that add values
+// standard initialization:
+// hh_set_t set = { .map = { .bucket_count = 64 } };
+typedef struct {
+    hh_map_t map;
+    // the arena holding every member, allocated on first use unless map.storage was provided
+    hh_arena* keys;
+} hh_set_t;
+
+// add a key to the set, does nothing if it is already a member
+// returns truthy on success
+_Bool
+hh_set_add(hh_set_t* set, const void* key, size_t size_key);
+// returns truthy if the key is a member of the set
+_Bool
+hh_set_has(const hh_set_t* set, const void* key, size_t size_key);
+// remove a key from the set
+// returns truthy if the key was a member
+_Bool
+hh_set_del(hh_set_t* set, const void* key, size_t size_key);
+#define hh_set_add_cstr(set, key) hh_set_add(set, key, strlen(key))
+#define hh_set_has_cstr(set, key) hh_set_has(set, key, strlen(key))
+#define hh_set_del_cstr(set, key) hh_set_del(set, key, strlen(key))
+// iterator macro for hh_set_t, `it` is an hh_map_it_t whose key and size_key describe the member
+// hh_set_it(&set, it) printf("%.*s\n", (int) it.size_key, (const char*) it.key);
+#define hh_set_it(set, it) hh_map_it(&(set)->map, it)
+// adds every member of `other` to `set`
+// only the smaller of the two sets is probed for, the larger one's entries are placed without comparing keys
+// when both sets hash alike (same hash function and seed), stored hashes are reused
+// returns truthy on success
+_Bool
+hh_set_union(hh_set_t* set, const hh_set_t* other);
+// removes every member of `set` that is not in `other`, iterating whichever set is smaller
+// returns truthy on success
+_Bool
+hh_set_intersect(hh_set_t* set, const hh_set_t* other);
+// free hh_set_t
+void
+hh_set_free(hh_set_t* set);
+
 // structure representing the argument parser tree
 // NOTE: must be 0 initialized
 // hh_args_t manages all allocations internally, including parsed paths
@@ -505,9 +1092,15 @@ hh_has_suffix(const char* str, const char* suffix);
 
 // internal array components
 typedef struct { 
-    size_t len, cap, elem_size; 
+    size_t len, cap, elem_size, flags; 
 } hh_darrheader_t;
 
+// hh_darrheader_t flags
+// the array is backed by a file (see hh_darropen)
+#define HH__DARR_MAPPED 0x1
+// the array lives in storage it doesn't own (see HH_DARR_INLINE)
+#define HH__DARR_INLINE 0x2
+
 // helper macros for dynamic array implementation
 #define hh_darrheader(arr)     (((hh_darrheader_t*) arr) - 1)
 #define hh_darrnew(arr)        ((arr) = HH__darrnew(HH_ARR_CAP_DEFAULT, sizeof(*arr)))
@@ -519,9 +1112,67 @@ HH__darrnew(size_t cap, size_t elem_size);
 void 
 HH__darrgrow(void** arrp, size_t n, size_t elem_size);
 size_t
+HH__darrgrowcap(size_t cap, size_t min_cap);
+size_t
 HH__darradd(void** arrp, size_t n, size_t elem_size);
+size_t
+HH__darraddn_uninit(void** arrp, size_t n, size_t elem_size);
+size_t
+HH__darrputn(void** arrp, const void* ptr, size_t n, size_t elem_size);
+size_t
+HH__darrreserve(void** arrp, size_t n, size_t elem_size);
+size_t
+HH__darrshrink(void** arrp);
+size_t
+HH__darrputstr(char** arrp, const char* str);
 void
 HH__darrswap(void* arrp, size_t i, size_t j);
+size_t
+HH__darrinsert(void* arrp, size_t i);
+void
+HH__darrdelrange(void* arrp, size_t i, size_t n);
+void
+HH__darrfree(void* arr);
+void*
+HH__darrinline(hh_darrheader_t* arr_hdr, void* elems, size_t cap, size_t elem_size);
+_Bool
+HH__darropen(void** arrp, const char* path, size_t elem_size);
+_Bool
+HH__darrsync(void* arr);
+
+// log2 of the element count of the first hh_segarr segment
+#ifndef HH_SEGARR_BASE_BITS
+#define HH_SEGARR_BASE_BITS 4
+#endif // HH_SEGARR_BASE_BITS
+
+// an hh_segarr's table holds a pointer per segment, enough for any size_t index
+#define HH__SEGARR_SEGMENTS (sizeof(size_t) * 8 - HH_SEGARR_BASE_BITS)
+
+// segment k holds 2^(k + HH_SEGARR_BASE_BITS) elements and starts at index (2^k - 1) << HH_SEGARR_BASE_BITS,
+// so the segment of index i is the highest set bit of (i >> HH_SEGARR_BASE_BITS) + 1
+static inline HH_UNUSED size_t
+HH__segarr_seg(size_t i) {
+    size_t val = (i >> HH_SEGARR_BASE_BITS) + 1;
+#if defined(__GNUC__) || defined(__clang__)
+    return (sizeof(unsigned long long) * 8 - 1) - (size_t) __builtin_clzll((unsigned long long) val);
+#else
+    size_t k = 0;
+    while(val >>= 1) ++k;
+    return k;
+#endif
+}
+
+// offset of index i within its segment
+static inline HH_UNUSED size_t
+HH__segarr_off(size_t i) {
+    return i - ((((size_t) 1 << HH__segarr_seg(i)) - 1) << HH_SEGARR_BASE_BITS);
+}
+
+// helper functions for segmented array
+size_t
+HH__segarradd(void*** arrp, size_t n, size_t elem_size, _Bool zero);
+void
+HH__segarrfree(void** arr);
 
 // arena type
 // placed here because the user should never have to interact with it
@@ -530,6 +1181,10 @@ struct HH__arena {
     char* end;
     char* cur;
     hh_arena* next; 
+    // the heap page currently being allocated from, only tracked by the first page
+    // keeps allocation O(1) instead of walking the chain
+    // NULL while the first page is current, so an hh_arena can still be copied by value
+    hh_arena* tail;
 };
 
 // the default size of a 'page' in the allocator
@@ -538,6 +1193,28 @@ struct HH__arena {
 #define HH_ARENA_DEFAULT_SIZE (256 * 1024)
 #endif // HH_ARENA_DEFAULT_SIZE
 
+// C99 has no max_align_t, so approximate it with the strictest fundamental types
+typedef union {
+    long double ld;
+    long long ll;
+    double d;
+    void* p;
+    void (*fp)(void);
+} HH__max_align_t;
+struct HH__max_align_probe { char c; HH__max_align_t t; };
+
+// the alignment of every hh_arena_alloc result
+// can be overwritten by the user (must be a power of two)
+#ifndef HH_ARENA_ALIGN
+#define HH_ARENA_ALIGN offsetof(struct HH__max_align_probe, t)
+#endif // HH_ARENA_ALIGN
+
+// the number of unused pages kept by hh_arena_rewind and hh_arena_reset
+// any beyond this are freed, can be overwritten by the user
+#ifndef HH_ARENA_RETAIN_MAX
+#define HH_ARENA_RETAIN_MAX SIZE_MAX
+#endif // HH_ARENA_RETAIN_MAX
+
 // helper functions for hh_path
 char*
 HH__path_join(char* path, ...);
@@ -606,10 +1283,82 @@ hh_getdelim(char** buf, size_t* bufsiz, int delimiter, FILE* fp);
 ptrdiff_t // NO PREFIX STRIPPING
 hh_getline(char** buf, size_t* bufsiz, FILE* fp);
 
-hh_map_entry_t
+// number of control bytes in a probing group of hh_map_t
+#define HH__MAP_GROUP_WIDTH 16
+// control byte markers
+// full slots store the low 7 bits of the key's hash instead
+#define HH__MAP_CTRL_EMPTY   ((uint8_t) 0x80)
+#define HH__MAP_CTRL_DELETED ((uint8_t) 0xFE)
+
+// define this to force the scalar probing fallback, even when SSE2 is available
+// #define HH_MAP_NO_SIMD
+
+// define this to enable hh_map_concurrent_t and the threads of hh_map_build,
+// outside of Windows they use pthreads (compile and link with -pthread)
+// #define HH_MAP_THREADS
+
+// the default maximum load factor of hh_map_t
+// can be overwritten by the user, must be in (0, 1]
+#ifndef HH_MAP_MAX_LOAD
+#define HH_MAP_MAX_LOAD 0.875
+#endif // HH_MAP_MAX_LOAD
+
+// the number of keys hh_map_get_many has in flight at once
+// can be overwritten by the user
+#ifndef HH_MAP_BATCH
+#define HH_MAP_BATCH 16
+#endif // HH_MAP_BATCH
+
+// the default number of shards in hh_map_concurrent_t
+// can be overwritten by the user
+#ifndef HH_MAP_SHARD_COUNT
+#define HH_MAP_SHARD_COUNT 64
+#endif // HH_MAP_SHARD_COUNT
+
+// the number of old slots migrated per operation on an incremental hh_map_t
+// can be overwritten by the user
+#ifndef HH_MAP_REHASH_STEP
+#define HH_MAP_REHASH_STEP 64
+#endif // HH_MAP_REHASH_STEP
+
+// the average number of keys that share a displacement in hh_map_frozen_t
+// larger buckets shrink the displacement table, but make hh_map_freeze slower
+// can be overwritten by the user
+#ifndef HH_MAP_FREEZE_BUCKET_SIZE
+#define HH_MAP_FREEZE_BUCKET_SIZE 3
+#endif // HH_MAP_FREEZE_BUCKET_SIZE
+
+// smallest table size of an HH_MAP_DEFINE map that holds n entries, 0 if it isn't representable
+static inline HH_UNUSED size_t
+HH__map_define_capacity(size_t n) {
+    size_t bucket_count = HH__MAP_GROUP_WIDTH;
+    while((size_t) ((double) bucket_count * HH_MAP_MAX_LOAD) < n) {
+        if(bucket_count > SIZE_MAX / 2) return 0;
+        bucket_count *= 2;
+    }
+    return bucket_count;
+}
+
+// the default hash of HH_MAP_DEFINE
+// mixes 8 bytes at a time, so it reduces to a few instructions when size is a constant
+static inline HH_UNUSED size_t
+HH__map_hash_fixed(const void* key, size_t size) {
+    const uint8_t* ptr = key;
+    uint64_t hash = 0x9E3779B97F4A7C15ull ^ size, word;
+    for(; size > 0; ptr += sizeof(word), size -= HH_MIN(size, sizeof(word))) {
+        word = 0;
+        memcpy(&word, ptr, HH_MIN(size, sizeof(word)));
+        hash = (hash ^ word) * 0xBF58476D1CE4E5B9ull;
+        hash ^= hash >> 31;
+    }
+    hash *= 0x94D049BB133111EBull;
+    return (size_t) (hash ^ (hash >> 32));
+}
+
+hh_map_it_t
 HH__map_it_begin(const hh_map_t* map);
 void
-HH__map_it_next(const hh_map_t* map, hh_map_entry_t* entry);
+HH__map_it_next(hh_map_it_t* it);
 
 // in practice, this value does not need to be modified
 #ifndef HH_ARGS_BUCKET_COUNT
@@ -691,19 +1440,136 @@ HH__args_add_flag(hh_args_t* args, hh_flag_type type, hh_flag_opt opt);
 #include <errno.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <time.h>
 #ifdef HH_SPAN_RETURN_ODDITY_ON_PARSE_FAILURE
 #include <float.h>
 #include <math.h>
 #include <limits.h>
 #endif // HH_SPAN_RETURN_ODDITY_ON_PARSE_FAILURE
 
+// SSE2 is used to probe hh_map_t control bytes
+#if !defined(HH_MAP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define HH__MAP_SSE2
+#include <emmintrin.h>
+#endif
+
 // platform-dependent includes
 #ifdef _WIN32
 #include <io.h>
 #include <windows.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#ifdef HH_MAP_THREADS
+#include <pthread.h>
+#endif // HH_MAP_THREADS
+#endif // _WIN32
+
+#ifdef HH_MAP_THREADS
+// threads used by hh_map_build
+// the worker runs on a new thread between HH__thread_start and HH__thread_join
+typedef struct {
+    void (*fn)(void*);
+    void* arg;
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    pthread_t handle;
+#endif // _WIN32
+} HH__thread;
+
+#ifdef _WIN32
+static DWORD WINAPI
+HH__thread_main(LPVOID thread) {
+    ((HH__thread*) thread)->fn(((HH__thread*) thread)->arg);
+    return 0;
+}
+#else
+static void*
+HH__thread_main(void* thread) {
+    ((HH__thread*) thread)->fn(((HH__thread*) thread)->arg);
+    return NULL;
+}
+#endif // _WIN32
+
+static _Bool
+HH__thread_start(HH__thread* thread, void (*fn)(void*), void* arg) {
+    thread->fn = fn;
+    thread->arg = arg;
+#ifdef _WIN32
+    thread->handle = CreateThread(NULL, 0, HH__thread_main, thread, 0, NULL);
+    return thread->handle != NULL;
+#else
+    return pthread_create(&thread->handle, NULL, HH__thread_main, thread) == 0;
+#endif // _WIN32
+}
+
+static void
+HH__thread_join(HH__thread* thread) {
+#ifdef _WIN32
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+#else
+    pthread_join(thread->handle, NULL);
+#endif // _WIN32
+}
+
+static size_t
+HH__thread_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return HH_MAX((size_t) info.dwNumberOfProcessors, 1);
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return (count > 0) ? (size_t) count : 1;
+#endif // _WIN32
+}
+
+// reader-writer lock used by hh_map_concurrent_t
+#ifdef _WIN32
+typedef SRWLOCK HH__rwlock;
+#define HH__rwlock_init(lock)      (InitializeSRWLock(lock), 1)
+#define HH__rwlock_destroy(lock)   ((void) (lock))
+#define HH__rwlock_read(lock)      AcquireSRWLockShared(lock)
+#define HH__rwlock_read_end(lock)  ReleaseSRWLockShared(lock)
+#define HH__rwlock_write(lock)     AcquireSRWLockExclusive(lock)
+#define HH__rwlock_write_end(lock) ReleaseSRWLockExclusive(lock)
+#else
+typedef pthread_rwlock_t HH__rwlock;
+#define HH__rwlock_init(lock)      (pthread_rwlock_init((lock), NULL) == 0)
+#define HH__rwlock_destroy(lock)   ((void) pthread_rwlock_destroy(lock))
+#define HH__rwlock_read(lock)      ((void) pthread_rwlock_rdlock(lock))
+#define HH__rwlock_read_end(lock)  ((void) pthread_rwlock_unlock(lock))
+#define HH__rwlock_write(lock)     ((void) pthread_rwlock_wrlock(lock))
+#define HH__rwlock_write_end(lock) ((void) pthread_rwlock_unlock(lock))
+#endif // _WIN32
+#endif // HH_MAP_THREADS
+
+// atomic counter used by hh_hash_seed_random, so concurrent map inits draw distinct seeds
+#ifdef _WIN32
+typedef LONG64 HH__counter;
+#define HH__counter_next(counter) ((uint64_t) InterlockedIncrement64(counter))
+#elif defined(__GNUC__) || defined(__clang__)
+typedef uint64_t HH__counter;
+#define HH__counter_next(counter) __atomic_add_fetch((counter), 1, __ATOMIC_RELAXED)
+#elif defined(HH_MAP_THREADS)
+typedef uint64_t HH__counter;
+static uint64_t
+HH__counter_next(HH__counter* counter) {
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&lock);
+    uint64_t next = ++(*counter);
+    pthread_mutex_unlock(&lock);
+    return next;
+}
+#else
+// without atomics or pthreads, concurrent calls may draw the same value,
+// their seeds still differ by the address of their stack frames
+typedef uint64_t HH__counter;
+#define HH__counter_next(counter) (++(*(counter)))
 #endif // _WIN32
 
 void*
@@ -723,47 +1589,207 @@ hh_calloc_checked(size_t num, size_t size) {
 void*
 HH__darrnew(size_t cap, size_t elem_size) {
     HH_ASSERT(elem_size > 0, "HH__darrnew received invalid element size");
-    void* arr = (((hh_darrheader_t*) calloc(1, sizeof(hh_darrheader_t) + elem_size * cap)) + 1);
-    HH_ASSERT(arr != NULL, "HH__darrnew failed to allocate array");
-    hh_darrheader(arr)->len = 0;
-    hh_darrheader(arr)->cap = cap;
-    hh_darrheader(arr)->elem_size = elem_size;
-    return arr;
+    hh_darrheader_t* arr_hdr = HH_DARR_REALLOC(NULL, sizeof(hh_darrheader_t) + elem_size * cap);
+    HH_ASSERT(arr_hdr != NULL, "HH__darrnew failed to allocate array");
+    arr_hdr->len = 0;
+    arr_hdr->cap = cap;
+    arr_hdr->elem_size = elem_size;
+    arr_hdr->flags = 0;
+    return (void*) (arr_hdr + 1);
+}
+
+size_t
+HH__darrgrowcap(size_t cap, size_t min_cap) {
+    // capacity may also be 0 after hh_darrshrink
+    if(cap == 0) return HH_MAX(min_cap, HH_ARR_CAP_DEFAULT);
+    while(cap < min_cap) cap *= 2;
+    return cap;
+}
+
+// header preceding the hh_darrheader_t of a file-backed array
+// `file` and `size_mapping` describe the current mapping, their values in the file are stale
+typedef struct {
+    uint32_t magic, version;
+    uint64_t size_word;
+    uint64_t size_mapping;
+    uint64_t file;
+} HH__darrmap_header;
+
+#define HH__DARRMAP_MAGIC 0x52414448u // "HDAR", little-endian
+#define HH__DARRMAP_VERSION 1u
+// elements begin this many bytes into the file
+#define HH__DARRMAP_OFFSET (sizeof(HH__darrmap_header) + sizeof(hh_darrheader_t))
+#define HH__darrmap(arr) (((HH__darrmap_header*) hh_darrheader(arr)) - 1)
+
+// maps size bytes of the file for reading and writing, extending it if necessary
+// returns NULL on failure
+static void*
+HH__darrmap_view(uint64_t file, size_t size) {
+#ifdef _WIN32
+    // a mapping larger than the file extends it
+    HANDLE view = CreateFileMappingA((HANDLE) (uintptr_t) file, NULL, PAGE_READWRITE, 
+        (DWORD) ((uint64_t) size >> 32), (DWORD) ((uint64_t) size & 0xFFFFFFFF), NULL);
+    if(view == NULL) return NULL;
+    // the view keeps the file mapping alive after its handle is closed
+    void* mapping = MapViewOfFile(view, FILE_MAP_WRITE, 0, 0, size);
+    CloseHandle(view);
+    return mapping;
+#else
+    int fd = (int) file;
+    struct stat st;
+    if(fstat(fd, &st) != 0) return NULL;
+    if((uint64_t) st.st_size < (uint64_t) size && ftruncate(fd, (off_t) size) != 0) return NULL;
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return (mapping == MAP_FAILED) ? NULL : mapping;
+#endif // _WIN32
+}
+
+static void
+HH__darrmap_unmap(void* mapping, size_t size_mapping) {
+#ifdef _WIN32
+    (void) size_mapping;
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size_mapping);
+#endif // _WIN32
+}
+
+// maps a file-backed array with room for cap elements, then unmaps its previous view
+static void
+HH__darrmap_resize(void** arr_ptr, size_t cap) {
+    HH__darrmap_header* map_hdr = HH__darrmap(*arr_ptr);
+    size_t elem_size = hh_darrheader(*arr_ptr)->elem_size;
+    HH_ASSERT(cap <= (SIZE_MAX - HH__DARRMAP_OFFSET) / elem_size, "HH__darrmap_resize received excessive capacity");
+    size_t size_mapping = HH__DARRMAP_OFFSET + cap * elem_size;
+    // both views share the page cache, so elements are never copied
+    HH__darrmap_header* mapping = HH__darrmap_view(map_hdr->file, size_mapping);
+    HH_ASSERT(mapping != NULL, "HH__darrmap_resize failed to map array");
+    HH__darrmap_unmap(map_hdr, (size_t) map_hdr->size_mapping);
+    mapping->size_mapping = size_mapping;
+    hh_darrheader_t* arr_hdr = (hh_darrheader_t*) (mapping + 1);
+    arr_hdr->cap = cap;
+    *arr_ptr = (void*) (arr_hdr + 1);
 }
 
 void 
 HH__darrgrow(void** arr_ptr, size_t n, size_t elem_size) {
-    hh_darrheader_t* arr_hdr;
-    if(*arr_ptr == NULL) {
-        arr_hdr = calloc(1, sizeof(hh_darrheader_t) + elem_size * HH_MAX(n, HH_ARR_CAP_DEFAULT));
-        HH_ASSERT(arr_hdr != NULL, "HH__darrgrow failed to allocate array");
-        arr_hdr->len = 0;
-        arr_hdr->cap = HH_MAX(n, HH_ARR_CAP_DEFAULT);
-        arr_hdr->elem_size = elem_size;
-        *arr_ptr = (void*) (arr_hdr + 1);
+    hh_darrheader_t* arr_hdr = (*arr_ptr == NULL) ? NULL : hh_darrheader(*arr_ptr);
+    size_t len = (arr_hdr == NULL) ? 0 : arr_hdr->len;
+    size_t cap = (arr_hdr == NULL) ? 0 : arr_hdr->cap;
+    if(arr_hdr != NULL && len + n <= cap) return;
+    cap = HH_DARR_GROW(cap, len + n, elem_size);
+    HH_ASSERT(cap >= len + n, "HH_DARR_GROW returned insufficient capacity (cap: %zu, required: %zu)", cap, len + n);
+    if(arr_hdr != NULL && (arr_hdr->flags & HH__DARR_MAPPED)) {
+        HH__darrmap_resize(arr_ptr, cap);
         return;
     }
-    arr_hdr = hh_darrheader(*arr_ptr);
-    if(arr_hdr->len + n >= arr_hdr->cap) {
-        while(arr_hdr->len + n >= arr_hdr->cap) arr_hdr->cap *= 2;
-        arr_hdr = realloc(arr_hdr, sizeof(hh_darrheader_t) + arr_hdr->cap * arr_hdr->elem_size);
-        HH_ASSERT(arr_hdr != NULL, "HH__darrgrow failed to allocate array");
-        *arr_ptr = (void*) (arr_hdr + 1);
-    }
+    // an inline array spills to the heap
+    _Bool spill = arr_hdr != NULL && (arr_hdr->flags & HH__DARR_INLINE);
+    arr_hdr = HH_DARR_REALLOC(spill ? NULL : arr_hdr, sizeof(hh_darrheader_t) + cap * elem_size);
+    HH_ASSERT(arr_hdr != NULL, "HH__darrgrow failed to allocate array");
+    if(spill) memcpy(arr_hdr + 1, *arr_ptr, len * elem_size);
+    if(*arr_ptr == NULL || spill) arr_hdr->flags = 0;
+    arr_hdr->len = len;
+    arr_hdr->cap = cap;
+    arr_hdr->elem_size = elem_size;
+    *arr_ptr = (void*) (arr_hdr + 1);
 }
 
 size_t
 HH__darradd(void** arr_ptr, size_t n, size_t elem_size) {
     HH_ASSERT(elem_size > 0, "HH__darradd received invalid element size");
+    size_t len = HH__darraddn_uninit(arr_ptr, n, elem_size);
+    if(n > 0) memset((char*) (*arr_ptr) + len * elem_size, 0, elem_size * n);
+    return len;
+}
+
+size_t
+HH__darraddn_uninit(void** arr_ptr, size_t n, size_t elem_size) {
+    HH_ASSERT(elem_size > 0, "HH__darraddn_uninit received invalid element size");
     HH__darrgrow(arr_ptr, n, elem_size);
-    size_t len = hh_darrlen(*arr_ptr);
-    if(n > 0) {
-        memset((char*) (*arr_ptr) + len * elem_size, 0, elem_size * n);
-        hh_darrheader(*arr_ptr)->len = len + n;
+    hh_darrheader_t* arr_hdr = hh_darrheader(*arr_ptr);
+    arr_hdr->len += n;
+    return arr_hdr->len - n;
+}
+
+size_t
+HH__darrputn(void** arr_ptr, const void* ptr, size_t n, size_t elem_size) {
+    HH_ASSERT(ptr != NULL || n == 0, "HH__darrputn received NULL source");
+    // a source within the array is moved along with it when the array grows
+    uintptr_t begin = (uintptr_t) *arr_ptr, src = (uintptr_t) ptr;
+    _Bool inner = *arr_ptr != NULL && src >= begin && src < begin + hh_darrcap(*arr_ptr) * elem_size;
+    size_t len = HH__darraddn_uninit(arr_ptr, n, elem_size);
+    if(inner) ptr = (const char*) (*arr_ptr) + (src - begin);
+    if(n > 0) memmove((char*) (*arr_ptr) + len * elem_size, ptr, elem_size * n);
+    return len;
+}
+
+size_t
+HH__darrreserve(void** arr_ptr, size_t n, size_t elem_size) {
+    HH_ASSERT(elem_size > 0, "HH__darrreserve received invalid element size");
+    if(n <= hh_darrcap(*arr_ptr)) return hh_darrcap(*arr_ptr);
+    HH__darrgrow(arr_ptr, n - hh_darrlen(*arr_ptr), elem_size);
+    return hh_darrcap(*arr_ptr);
+}
+
+size_t
+HH__darrshrink(void** arr_ptr) {
+    if(*arr_ptr == NULL) return 0;
+    hh_darrheader_t* arr_hdr = hh_darrheader(*arr_ptr);
+    // inline storage can't shrink
+    if(arr_hdr->cap == arr_hdr->len || (arr_hdr->flags & HH__DARR_INLINE)) return arr_hdr->cap;
+    if(arr_hdr->flags & HH__DARR_MAPPED) {
+        HH__darrmap_resize(arr_ptr, arr_hdr->len);
+        return hh_darrcap(*arr_ptr);
     }
+    arr_hdr = HH_DARR_REALLOC(arr_hdr, sizeof(hh_darrheader_t) + arr_hdr->len * arr_hdr->elem_size);
+    HH_ASSERT(arr_hdr != NULL, "HH__darrshrink failed to reallocate array");
+    arr_hdr->cap = arr_hdr->len;
+    *arr_ptr = (void*) (arr_hdr + 1);
+    return arr_hdr->cap;
+}
+
+size_t
+HH__darrputstr(char** arr_ptr, const char* str) {
+    HH_ASSERT(str != NULL, "HH__darrputstr received NULL string");
+    size_t len = hh_darrlen(*arr_ptr);
+    // overwrite the existing null-terminator
+    if(len > 0 && (*arr_ptr)[len - 1] == '\0') hh_darrheader(*arr_ptr)->len = --len;
+    (void) HH__darrputn((void**) arr_ptr, str, strlen(str) + 1, sizeof(char));
     return len;
 }
 
+// swaps size bytes between a and b
+// common element sizes are moved through registers (memcpy of a constant size),
+// other sizes through a stack buffer, one chunk at a time
+static void
+HH__memswap(char* restrict a, char* restrict b, size_t size) {
+#define HH__MEMSWAP_FIXED(n) case n: { \
+        unsigned char tmp[n]; \
+        memcpy(tmp, a, n); \
+        memcpy(a, b, n); \
+        memcpy(b, tmp, n); \
+        return; \
+    }
+    switch(size) {
+        HH__MEMSWAP_FIXED(1)
+        HH__MEMSWAP_FIXED(2)
+        HH__MEMSWAP_FIXED(4)
+        HH__MEMSWAP_FIXED(8)
+        HH__MEMSWAP_FIXED(16)
+        HH__MEMSWAP_FIXED(32)
+        default: break;
+    }
+#undef HH__MEMSWAP_FIXED
+    unsigned char tmp[64];
+    for(size_t k = 0, chunk; k < size; k += chunk) {
+        chunk = HH_MIN(size - k, sizeof(tmp));
+        memcpy(tmp, a + k, chunk);
+        memcpy(a + k, b + k, chunk);
+        memcpy(b + k, tmp, chunk);
+    }
+}
+
 void
 HH__darrswap(void* arr, size_t i, size_t j) {
     HH_ASSERT(arr != NULL, "HH__darrswap received NULL array");
@@ -771,76 +1797,304 @@ HH__darrswap(void* arr, size_t i, size_t j) {
     HH_ASSERT(i < hh_darrlen(arr) && j < hh_darrlen(arr), "HH__darrswap received invalid indices (i: %zu, j: %zu, len: %zu)", i, j, hh_darrlen(arr));
     if(i == j) return;
     size_t elem_size = hh_darrheader(arr)->elem_size;
+    HH__memswap(((char*) arr) + i * elem_size, ((char*) arr) + j * elem_size, elem_size);
+}
+
+size_t
+HH__darrinsert(void* arr, size_t i) {
+    // the inserted element is staged at index len, then moved into place through a temporary copy,
+    // which is only heap-allocated for elements wider than 64 bytes
+    size_t len = hh_darrlen(arr);
+    HH_ASSERT(i <= len, "HH__darrinsert received invalid index (i: %zu, len: %zu)", i, len);
+    size_t elem_size = hh_darrheader(arr)->elem_size;
     char* elem_i = ((char*) arr) + i * elem_size;
-    char* elem_j = ((char*) arr) + j * elem_size;
-    for(size_t k = 0; k < elem_size; ++k) {
-        elem_i[k] = elem_i[k] ^ elem_j[k];
-        elem_j[k] = elem_i[k] ^ elem_j[k];
-        elem_i[k] = elem_i[k] ^ elem_j[k];
-    }
+    unsigned char tmp_small[64];
+    unsigned char* tmp = (elem_size <= sizeof(tmp_small)) ? tmp_small : malloc(elem_size);
+    HH_ASSERT(tmp != NULL, "HH__darrinsert failed to allocate %zu bytes", elem_size);
+    memcpy(tmp, ((char*) arr) + len * elem_size, elem_size);
+    memmove(elem_i + elem_size, elem_i, (len - i) * elem_size);
+    memcpy(elem_i, tmp, elem_size);
+    if(tmp != tmp_small) free(tmp);
+    hh_darrheader(arr)->len = len + 1;
+    return i;
 }
 
-void*
-hh_arena_alloc(hh_arena* arena, size_t sz) {
-    // if this is the first allocation
-    if(arena->ptr == NULL) {
-        size_t sz_alloc = HH_MAX(HH_ARENA_DEFAULT_SIZE, sz);
-        arena->ptr = malloc(sz_alloc);
-        if(arena->ptr == NULL) return NULL;
-        arena->end = arena->ptr + sz_alloc;
-        arena->cur = arena->ptr + sz;
-        return arena->ptr;
-    }
-    // if the requested allocation size is too small to fit in the current segment
-    if((size_t) (arena->end - arena->cur) < sz) {
-        if(arena->next == NULL) arena->next = calloc(1, sizeof(hh_arena));
-        if(arena->next == NULL) return NULL;
-        return hh_arena_alloc(arena->next, sz);
-    }
-    // otherwise, fill in the space in this segment
-    void* ptr = arena->cur;
-    arena->cur += sz;
-    return ptr;
+void
+HH__darrdelrange(void* arr, size_t i, size_t n) {
+    size_t len = hh_darrlen(arr);
+    HH_ASSERT(n <= len && i <= len - n, "HH__darrdelrange received invalid range (i: %zu, n: %zu, len: %zu)", i, n, len);
+    if(n == 0) return;
+    size_t elem_size = hh_darrheader(arr)->elem_size;
+    char* elem_i = ((char*) arr) + i * elem_size;
+    memmove(elem_i, elem_i + n * elem_size, (len - i - n) * elem_size);
+    hh_darrheader(arr)->len = len - n;
 }
 
 void
-hh_arena_free(hh_arena* arena) {
-    if(arena == NULL) return;
-    if(arena->next != NULL) {
-        hh_arena_free(arena->next);
-        free(arena->next);
+HH__darrfree(void* arr) {
+    if(arr == NULL) return;
+    hh_darrheader_t* arr_hdr = hh_darrheader(arr);
+    if(arr_hdr->flags & HH__DARR_INLINE) return;
+    if(!(arr_hdr->flags & HH__DARR_MAPPED)) {
+        HH_DARR_FREE(arr_hdr);
+        return;
     }
-    free(arena->ptr);
-    memset(arena, 0, sizeof(hh_arena));
+    // trim the file to the array's length
+    arr_hdr->cap = arr_hdr->len;
+    HH__darrmap_header* map_hdr = HH__darrmap(arr);
+    uint64_t file = map_hdr->file, size_file = HH__DARRMAP_OFFSET + arr_hdr->len * arr_hdr->elem_size;
+    HH__darrmap_unmap(map_hdr, (size_t) map_hdr->size_mapping);
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG) size_file;
+    if(SetFilePointerEx((HANDLE) (uintptr_t) file, size, NULL, FILE_BEGIN)) SetEndOfFile((HANDLE) (uintptr_t) file);
+    CloseHandle((HANDLE) (uintptr_t) file);
+#else
+    if(ftruncate((int) file, (off_t) size_file) != 0) {
+        HH_ERR("Failed to trim file-backed array.");
+    }
+    close((int) file);
+#endif // _WIN32
 }
 
-char* 
-hh_path_alloc(const char *raw) {
-    char* path = NULL;
+void*
+HH__darrinline(hh_darrheader_t* arr_hdr, void* elems, size_t cap, size_t elem_size) {
+    // HH_DARR_INLINE checks at compile time that the elements immediately follow the header
+    arr_hdr->len = 0;
+    arr_hdr->cap = cap;
+    arr_hdr->elem_size = elem_size;
+    arr_hdr->flags = HH__DARR_INLINE;
+    return elems;
+}
+
+_Bool
+HH__darropen(void** arr_ptr, const char* path, size_t elem_size) {
+    if(arr_ptr == NULL || path == NULL || elem_size == 0) return 0;
+    HH_ASSERT(*arr_ptr == NULL, "HH__darropen received an allocated array");
+    uint64_t file, size_file;
 #ifdef _WIN32
-    char* raw_abs = NULL;
-    DWORD len_win = GetFullPathNameA(raw, 0, NULL, NULL);
-    if(len_win == 0) return NULL;
-    raw_abs = malloc(len_win);
-    if(raw_abs == NULL) return NULL;
-    if(GetFullPathNameA(raw, len_win, raw_abs, NULL) == 0) {
-        free(raw_abs);
-        return NULL;
+    HANDLE handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(handle == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(handle, &size)) {
+        CloseHandle(handle);
+        return 0;
     }
-    if(raw_abs[0] >= 'a' && raw_abs[0] <= 'z' && raw_abs[1] == ':')
-        raw_abs[0] -= ('a' - 'A');
-    hh_darrputstr(path, raw_abs);
-    free(raw_abs);
-#else // _WIN32
-    char* cmd = NULL;
+    file = (uint64_t) (uintptr_t) handle;
+    size_file = (uint64_t) size.QuadPart;
+#else
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) return 0;
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    file = (uint64_t) fd;
+    size_file = (uint64_t) st.st_size;
+#endif // _WIN32
+    // an empty file receives a new array
+    _Bool created = (size_file == 0);
+    size_t cap = created ? HH_ARR_CAP_DEFAULT : 0;
+    if(created) size_file = HH__DARRMAP_OFFSET + cap * elem_size;
+    HH__darrmap_header* mapping = NULL;
+    if(size_file >= HH__DARRMAP_OFFSET && size_file <= SIZE_MAX) mapping = HH__darrmap_view(file, (size_t) size_file);
+    hh_darrheader_t* arr_hdr = (mapping == NULL) ? NULL : (hh_darrheader_t*) (mapping + 1);
+    if(created && arr_hdr != NULL) {
+        mapping->magic = HH__DARRMAP_MAGIC;
+        mapping->version = HH__DARRMAP_VERSION;
+        mapping->size_word = sizeof(size_t);
+        arr_hdr->len = 0;
+        arr_hdr->cap = cap;
+        arr_hdr->elem_size = elem_size;
+    }
+    _Bool ok = arr_hdr != NULL && 
+        mapping->magic == HH__DARRMAP_MAGIC && 
+        mapping->version == HH__DARRMAP_VERSION && 
+        mapping->size_word == sizeof(size_t) && 
+        arr_hdr->elem_size == elem_size && 
+        arr_hdr->len <= arr_hdr->cap && 
+        arr_hdr->cap <= (size_file - HH__DARRMAP_OFFSET) / elem_size;
+    if(!ok) {
+        if(mapping != NULL) HH__darrmap_unmap(mapping, (size_t) size_file);
+#ifdef _WIN32
+        CloseHandle(handle);
+#else
+        close(fd);
+#endif // _WIN32
+        return 0;
+    }
+    mapping->size_mapping = size_file;
+    mapping->file = file;
+    arr_hdr->flags = HH__DARR_MAPPED;
+    *arr_ptr = (void*) (arr_hdr + 1);
+    return 1;
+}
+
+_Bool
+HH__darrsync(void* arr) {
+    // arrays that aren't file-backed have nothing to flush
+    if(arr == NULL || !(hh_darrheader(arr)->flags & HH__DARR_MAPPED)) return 1;
+    HH__darrmap_header* map_hdr = HH__darrmap(arr);
+#ifdef _WIN32
+    return FlushViewOfFile(map_hdr, (size_t) map_hdr->size_mapping) && 
+        FlushFileBuffers((HANDLE) (uintptr_t) map_hdr->file);
+#else
+    return msync(map_hdr, (size_t) map_hdr->size_mapping, MS_SYNC) == 0;
+#endif // _WIN32
+}
+
+size_t
+HH__segarradd(void*** arr_ptr, size_t n, size_t elem_size, _Bool zero) {
+    HH_ASSERT(elem_size > 0, "HH__segarradd received invalid element size");
+    hh_darrheader_t* arr_hdr;
+    if(*arr_ptr == NULL) {
+        arr_hdr = HH_DARR_REALLOC(NULL, sizeof(hh_darrheader_t) + sizeof(void*) * HH__SEGARR_SEGMENTS);
+        HH_ASSERT(arr_hdr != NULL, "HH__segarradd failed to allocate array");
+        arr_hdr->len = 0;
+        arr_hdr->cap = 0;
+        arr_hdr->elem_size = elem_size;
+        arr_hdr->flags = 0;
+        *arr_ptr = (void**) (arr_hdr + 1);
+        for(size_t k = 0; k < HH__SEGARR_SEGMENTS; ++k) (*arr_ptr)[k] = NULL;
+    }
+    void** segs = *arr_ptr;
+    arr_hdr = hh_darrheader(segs);
+    size_t len = arr_hdr->len, k, size_seg;
+    // existing segments never move, growth only appends new ones
+    while(arr_hdr->cap < len + n) {
+        k = HH__segarr_seg(arr_hdr->cap);
+        size_seg = (size_t) 1 << (k + HH_SEGARR_BASE_BITS);
+        segs[k] = HH_DARR_REALLOC(NULL, size_seg * elem_size);
+        HH_ASSERT(segs[k] != NULL, "HH__segarradd failed to allocate segment");
+        arr_hdr->cap += size_seg;
+    }
+    // zero the new elements one segment at a time
+    for(size_t i = len, run; zero && i < len + n; i += run) {
+        k = HH__segarr_seg(i);
+        run = HH_MIN(len + n - i, ((size_t) 1 << (k + HH_SEGARR_BASE_BITS)) - HH__segarr_off(i));
+        memset((char*) segs[k] + HH__segarr_off(i) * elem_size, 0, run * elem_size);
+    }
+    arr_hdr->len = len + n;
+    return len;
+}
+
+void
+HH__segarrfree(void** arr) {
+    if(arr == NULL) return;
+    for(size_t k = 0; k < HH__SEGARR_SEGMENTS && arr[k] != NULL; ++k) HH_DARR_FREE(arr[k]);
+    HH_DARR_FREE(hh_darrheader(arr));
+}
+
+void*
+hh_arena_alloc(hh_arena* arena, size_t sz) {
+    return hh_arena_alloc_aligned(arena, sz, HH_ARENA_ALIGN);
+}
+
+void*
+hh_arena_alloc_aligned(hh_arena* arena, size_t sz, size_t align) {
+    HH_ASSERT(align != 0 && (align & (align - 1)) == 0, "Arena alignment must be a power of two: align = %zu", align);
+    hh_arena* page = (arena->tail == NULL) ? arena : arena->tail;
+    size_t pad = (size_t) (-(uintptr_t) page->cur & (align - 1));
+    // the remainder of a full page is abandoned, only the tail is ever allocated from
+    if(page->ptr == NULL || (size_t) (page->end - page->cur) < sz + pad) {
+        if(page->ptr != NULL) {
+            // pages past the tail were kept by a rewind or reset, the next one is reused if it fits
+            hh_arena* next = page->next;
+            if(next == NULL || (size_t) (next->end - next->ptr) < sz + align - 1) {
+                next = calloc(1, sizeof(hh_arena));
+                if(next == NULL) return NULL;
+                next->next = page->next;
+                page->next = next;
+            }
+            page = next;
+        }
+        arena->tail = (page == arena) ? NULL : page;
+        if(page->ptr == NULL) {
+            // malloc only guarantees fundamental alignment
+            size_t sz_alloc = HH_MAX(HH_ARENA_DEFAULT_SIZE, sz + align - 1);
+            page->ptr = malloc(sz_alloc);
+            if(page->ptr == NULL) return NULL;
+            page->end = page->ptr + sz_alloc;
+        }
+        page->cur = page->ptr;
+        pad = (size_t) (-(uintptr_t) page->cur & (align - 1));
+    }
+    void* ptr = page->cur + pad;
+    page->cur += pad + sz;
+    return ptr;
+}
+
+// frees every page in a chain, including the given one
+static void
+HH__arena_free_pages(hh_arena* page) {
+    // iterative, so long chains can't overflow the stack
+    while(page != NULL) {
+        hh_arena* next = page->next;
+        free(page->ptr);
+        free(page);
+        page = next;
+    }
+}
+
+void
+hh_arena_free(hh_arena* arena) {
+    if(arena == NULL) return;
+    HH__arena_free_pages(arena->next);
+    free(arena->ptr);
+    memset(arena, 0, sizeof(hh_arena));
+}
+
+hh_arena_mark_t
+hh_arena_mark(hh_arena* arena) {
+    hh_arena* page = (arena->tail == NULL) ? arena : arena->tail;
+    return (hh_arena_mark_t) { .page = arena->tail, .cur = page->cur };
+}
+
+void
+hh_arena_rewind(hh_arena* arena, hh_arena_mark_t mark) {
+    hh_arena* page = (mark.page == NULL) ? arena : mark.page;
+    // a mark taken before the first page was allocated has no position in it
+    page->cur = (mark.cur == NULL) ? page->ptr : mark.cur;
+    arena->tail = mark.page;
+    // pages past the tail are unused, keep the first HH_ARENA_RETAIN_MAX of them
+    for(size_t retained = 0; page->next != NULL && retained < HH_ARENA_RETAIN_MAX; ++retained) page = page->next;
+    HH__arena_free_pages(page->next);
+    page->next = NULL;
+}
+
+void
+hh_arena_reset(hh_arena* arena) {
+    hh_arena_rewind(arena, (hh_arena_mark_t) { .page = NULL, .cur = NULL });
+}
+
+char* 
+hh_path_alloc(const char *raw) {
+    char* path = NULL;
+#ifdef _WIN32
+    char* raw_abs = NULL;
+    DWORD len_win = GetFullPathNameA(raw, 0, NULL, NULL);
+    if(len_win == 0) return NULL;
+    raw_abs = malloc(len_win);
+    if(raw_abs == NULL) return NULL;
+    if(GetFullPathNameA(raw, len_win, raw_abs, NULL) == 0) {
+        free(raw_abs);
+        return NULL;
+    }
+    if(raw_abs[0] >= 'a' && raw_abs[0] <= 'z' && raw_abs[1] == ':')
+        raw_abs[0] -= ('a' - 'A');
+    hh_darrputstr(path, raw_abs);
+    free(raw_abs);
+#else // _WIN32
+    HH_DARR_INLINE(char, cmd, 256);
     hh_darrputstr(cmd, "readlink -m ");
     hh_darrputstr(cmd, raw);
     FILE *fp = popen(cmd, "r");
+    hh_darrfree(cmd);
     if(fp == NULL) {
         perror("popen");
         return NULL;
     }
-    hh_darrfree(cmd);
     int ch;
     while((ch = getc(fp)) != EOF && ch != '\n') 
         hh_darrput(path, (char) ch);
@@ -1079,26 +2333,122 @@ hh_span_next_opt_zu(hh_span_t* span, hh_span_opt opt, hh_span_t* err) {
 #undef HH__SPAN_PROLOGUE
 #undef HH__SPAN_EPILOGUE
 
-// adapted from the following link
-// https://gist.github.com/MohamedTaha98/ccdf734f13299efb73ff0b12f7ce429f
-// thanks to MohamedTaha98
+// adapted from wyhash (final version 4.2), released into the public domain
+// https://github.com/wangyi-fudan/wyhash
+// thanks to Wang Yi
+static void
+HH__hash_mum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 HH__u128;
+    HH__u128 r = (HH__u128) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif // __SIZEOF_INT128__
+}
+
+static uint64_t
+HH__hash_mix(uint64_t a, uint64_t b) {
+    HH__hash_mum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t
+HH__hash_read8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t
+HH__hash_read4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t
+hh_hash_bytes(const void* key, size_t len, uint64_t seed) {
+    static const uint64_t secret[4] = {
+        0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 
+        0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull
+    };
+    const uint8_t* p = key;
+    uint64_t a, b;
+    seed ^= HH__hash_mix(seed ^ secret[0], secret[1]);
+    if(len <= 16) {
+        if(len >= 4) {
+            // two overlapping reads cover every byte of keys in [4, 16]
+            a = (HH__hash_read4(p) << 32) | HH__hash_read4(p + ((len >> 3) << 2));
+            b = (HH__hash_read4(p + len - 4) << 32) | HH__hash_read4(p + len - 4 - ((len >> 3) << 2));
+        } else if(len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else a = b = 0;
+    } else {
+        size_t i = len;
+        if(i >= 48) {
+            // three independent lanes of 16 bytes each
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = HH__hash_mix(HH__hash_read8(p) ^ secret[1], HH__hash_read8(p + 8) ^ seed);
+                see1 = HH__hash_mix(HH__hash_read8(p + 16) ^ secret[2], HH__hash_read8(p + 24) ^ see1);
+                see2 = HH__hash_mix(HH__hash_read8(p + 32) ^ secret[3], HH__hash_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while(i >= 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16) {
+            seed = HH__hash_mix(HH__hash_read8(p) ^ secret[1], HH__hash_read8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = HH__hash_read8(p + i - 16);
+        b = HH__hash_read8(p + i - 8);
+    }
+    a ^= secret[1];
+    b ^= seed;
+    HH__hash_mum(&a, &b);
+    return HH__hash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+uint64_t
+hh_hash_seed_random(void) {
+    // mixes the clock with stack and static addresses (randomized by ASLR)
+    static HH__counter counter = 0;
+    uintptr_t local = (uintptr_t) &local;
+    uint64_t state[4] = {
+        (uint64_t) time(NULL), 
+        (uint64_t) clock(), 
+        (uint64_t) local ^ (uint64_t) (uintptr_t) &counter, 
+        HH__counter_next(&counter)
+    };
+    return hh_hash_bytes(state, sizeof(state), state[3]);
+}
+
 static size_t
-HH__map_hash_djb2(const void* key, size_t size_key) {
-    size_t hash = 5381;
-    for (size_t i = 0; i < size_key; ++i) hash = ((hash << 5) + hash) + (size_t) ((char*) key)[i];
-    return hash;
+HH__map_hash_with(hh_map_hash_f hash, uint64_t seed, const void* key, size_t size_key) {
+    return (hash == NULL) ? 
+        (size_t) hh_hash_bytes(key, size_key, seed) : 
+        hash(key, size_key);
 }
 
 static size_t
 HH__map_hash_generic(const hh_map_t* map, const void* key, size_t size_key) {
-    return ((map->hash == NULL) ? 
-        HH__map_hash_djb2(key, size_key) : 
-        (map->hash)(key, size_key)) % map->bucket_count;
+    return HH__map_hash_with(map->hash, map->seed, key, size_key);
 }
 
 static int
-HH__map_comp_generic(const hh_map_t* map, const void* key_query, size_t size_key_query, const void* key_in, size_t size_key_in) {
-    if(map->comp != NULL) return (map->comp)(key_query, size_key_query, key_in, size_key_in);
+HH__map_comp_with(hh_map_comp_f comp, const void* key_query, size_t size_key_query, const void* key_in, size_t size_key_in) {
+    if(comp != NULL) return comp(key_query, size_key_query, key_in, size_key_in);
     int result = memcmp(key_query, key_in, HH_MIN(size_key_query, size_key_in));
     if(result != 0) return result;
     if(size_key_query < size_key_in) return -1;
@@ -1106,32 +2456,420 @@ HH__map_comp_generic(const hh_map_t* map, const void* key_query, size_t size_key
     return 0;
 }
 
+static int
+HH__map_comp_generic(const hh_map_t* map, const void* key_query, size_t size_key_query, const void* key_in, size_t size_key_in) {
+    return HH__map_comp_with(map->comp, key_query, size_key_query, key_in, size_key_in);
+}
+
+// the low 7 bits of the hash are stored in the control byte,
+// the remaining bits select the first group to probe
+#define HH__MAP_TAG(hash) ((uint8_t) ((hash) & 0x7F))
+#define HH__MAP_IS_FULL(ctrl) (((ctrl) & 0x80) == 0)
+
+// entries are allocated out of line with the layout [hash, size_key, size_val, key, val]
+// the full hash is kept so that lookups can reject tag collisions without comparing keys,
+// and so that rehashing and iteration never need to hash a key again
+// compact maps encode size_key and size_val as LEB128 varints, 7 bits per byte
+#define HH__MAP_ENTRY_HEADER (sizeof(size_t) * 3)
+
+// returns a bitmask with bit i set if group[i] == ctrl
+static uint32_t
+HH__map_group_match(const uint8_t* group, uint8_t ctrl) {
+#ifdef HH__MAP_SSE2
+    __m128i bytes = _mm_loadu_si128((const __m128i*) group);
+    return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) ctrl)));
+#else
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < HH__MAP_GROUP_WIDTH; ++i) mask |= (uint32_t) (group[i] == ctrl) << i;
+    return mask;
+#endif // HH__MAP_SSE2
+}
+
+// returns a bitmask with bit i set if group[i] is either empty or deleted
+static uint32_t
+HH__map_group_match_free(const uint8_t* group) {
+#ifdef HH__MAP_SSE2
+    return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+#else
+    uint32_t mask = 0;
+    for(uint32_t i = 0; i < HH__MAP_GROUP_WIDTH; ++i) mask |= (uint32_t) (group[i] >> 7) << i;
+    return mask;
+#endif // HH__MAP_SSE2
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define HH__PREFETCH(ptr) __builtin_prefetch(ptr)
+#else
+#define HH__PREFETCH(ptr) ((void) (ptr))
+#endif
+
+// index of the lowest set bit, mask must be non-zero
+static size_t
+HH__map_ctz(uint32_t mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (size_t) __builtin_ctz(mask);
+#else
+    size_t idx = 0;
+    while(!(mask & 1)) { mask >>= 1; ++idx; }
+    return idx;
+#endif
+}
+
+#define HH__MAP_ENTRY_HASH(entry_begin) (((const size_t*) (entry_begin))[0])
+
+static size_t
+HH__map_varint_size(size_t val) {
+    size_t size = 1;
+    while(val >>= 7) ++size;
+    return size;
+}
+
+static char*
+HH__map_varint_write(char* ptr, size_t val) {
+    for(; val >= 0x80; val >>= 7) *(ptr++) = (char) ((val & 0x7F) | 0x80);
+    *(ptr++) = (char) val;
+    return ptr;
+}
+
+static const char*
+HH__map_varint_read(const char* ptr, size_t* val) {
+    *val = 0;
+    for(unsigned shift = 0;; shift += 7) {
+        uint8_t byte = (uint8_t) *(ptr++);
+        *val |= (size_t) (byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return ptr;
+    }
+}
+
+// number of bytes preceding the key of an entry
+static size_t
+HH__map_entry_header(_Bool compact, size_t size_key, size_t size_val) {
+    if(!compact) return HH__MAP_ENTRY_HEADER;
+    return sizeof(size_t) + HH__map_varint_size(size_key) + HH__map_varint_size(size_val);
+}
+
+// allocates an entry and fills in everything but the value, which is left uninitialized
+static char*
+HH__map_entry_alloc(const hh_map_t* map, size_t hash, const void* key, size_t size_key, size_t size_val) {
+    _Bool compact = map->compact;
+    size_t size_header = HH__map_entry_header(compact, size_key, size_val);
+    char* entry_begin;
+    if(map->storage != NULL) {
+        // the header only needs size_t alignment, so entries pack tighter than HH_ARENA_ALIGN
+        entry_begin = hh_arena_alloc_aligned(map->storage, size_header + size_key + size_val, sizeof(size_t));
+    } else entry_begin = malloc(size_header + size_key + size_val);
+    if(entry_begin == NULL) return NULL;
+    ((size_t*) entry_begin)[0] = hash;
+    if(compact) {
+        HH__map_varint_write(HH__map_varint_write(entry_begin + sizeof(size_t), size_key), size_val);
+    } else {
+        ((size_t*) entry_begin)[1] = size_key;
+        ((size_t*) entry_begin)[2] = size_val;
+    }
+    memcpy(entry_begin + size_header, key, size_key);
+    return entry_begin;
+}
+
+// entries allocated from an arena are left in place
+static void
+HH__map_entry_release(const hh_map_t* map, char* entry_begin) {
+    if(map->storage == NULL) free(entry_begin);
+}
+
+static hh_map_entry_t
+HH__map_entry_unpack(_Bool compact, const char* entry_begin) {
+    hh_map_entry_t entry;
+    if(compact) {
+        entry.key = HH__map_varint_read(HH__map_varint_read(entry_begin + sizeof(size_t), &entry.size_key), &entry.size_val);
+    } else {
+        entry.size_key = ((const size_t*) entry_begin)[1];
+        entry.size_val = ((const size_t*) entry_begin)[2];
+        entry.key = entry_begin + HH__MAP_ENTRY_HEADER;
+    }
+    entry.val = (const char*) entry.key + entry.size_key;
+    return entry;
+}
+
+// view of either the current table of hh_map_t or the one being migrated
+typedef struct {
+    size_t bucket_count;
+    uint8_t* ctrl;
+    char** slots;
+} HH__map_table;
+
+#define HH__MAP_TABLE(map)     ((HH__map_table) { (map)->bucket_count, (map)->ctrl, (map)->slots })
+#define HH__MAP_TABLE_OLD(map) ((HH__map_table) { (map)->old.bucket_count, (map)->old.ctrl, (map)->old.slots })
+
+// returns the slot containing the given key, SIZE_MAX if it isn't a member
+// groups are visited in triangular order, which covers every group
+// because the group count is a power of two
+// if free_idx is non-NULL, it receives the first empty or deleted slot along the way,
+// so that an insertion of a missing key doesn't have to probe again
+static size_t
+HH__map_find(const hh_map_t* map, HH__map_table table, size_t hash, const void* key, size_t size_key, size_t* free_idx) {
+    size_t mask = table.bucket_count / HH__MAP_GROUP_WIDTH - 1;
+    size_t group = (hash >> 7) & mask;
+    const uint8_t* ctrl;
+    hh_map_entry_t entry;
+    uint32_t match_free;
+    if(free_idx != NULL) *free_idx = SIZE_MAX;
+    for(size_t probe = 0; probe <= mask; ++probe) {
+        ctrl = table.ctrl + group * HH__MAP_GROUP_WIDTH;
+        if(free_idx != NULL && *free_idx == SIZE_MAX && (match_free = HH__map_group_match_free(ctrl)))
+            *free_idx = group * HH__MAP_GROUP_WIDTH + HH__map_ctz(match_free);
+        for(uint32_t match = HH__map_group_match(ctrl, HH__MAP_TAG(hash)); match; match &= match - 1) {
+            size_t idx = group * HH__MAP_GROUP_WIDTH + HH__map_ctz(match);
+            if(HH__MAP_ENTRY_HASH(table.slots[idx]) != hash) continue;
+            entry = HH__map_entry_unpack(map->compact, table.slots[idx]);
+            if(HH__map_comp_generic(map, key, size_key, entry.key, entry.size_key) == 0) return idx;
+        }
+        // an empty slot terminates every probe sequence that passes through this group
+        if(HH__map_group_match(ctrl, HH__MAP_CTRL_EMPTY)) return SIZE_MAX;
+        group = (group + probe + 1) & mask;
+    }
+    return SIZE_MAX;
+}
+
+// returns the first empty or deleted slot along the probe sequence of hash
+// SIZE_MAX if every slot in the table is occupied
+static size_t
+HH__map_find_free(HH__map_table table, size_t hash) {
+    size_t mask = table.bucket_count / HH__MAP_GROUP_WIDTH - 1;
+    size_t group = (hash >> 7) & mask;
+    uint32_t match;
+    for(size_t probe = 0; probe <= mask; ++probe) {
+        match = HH__map_group_match_free(table.ctrl + group * HH__MAP_GROUP_WIDTH);
+        if(match) return group * HH__MAP_GROUP_WIDTH + HH__map_ctz(match);
+        group = (group + probe + 1) & mask;
+    }
+    return SIZE_MAX;
+}
+
+// looks for the key in the current table, then in the old one
+// sets table to whichever table contains the returned slot
+// free_idx is forwarded to HH__map_find for the current table
+static size_t
+HH__map_locate(const hh_map_t* map, size_t hash, const void* key, size_t size_key, HH__map_table* table, size_t* free_idx) {
+    *table = HH__MAP_TABLE(map);
+    size_t idx = HH__map_find(map, *table, hash, key, size_key, free_idx);
+    if(idx != SIZE_MAX || map->old.ctrl == NULL) return idx;
+    *table = HH__MAP_TABLE_OLD(map);
+    return HH__map_find(map, *table, hash, key, size_key, NULL);
+}
+
+// smallest valid table size that holds n slots
+static size_t
+HH__map_capacity(size_t n) {
+    size_t cap = HH__MAP_GROUP_WIDTH;
+    while(cap < n) {
+        if(cap > SIZE_MAX / 2) return 0;
+        cap *= 2;
+    }
+    return cap;
+}
+
+static double
+HH__map_max_load(const hh_map_t* map) {
+    double load = (map->max_load > 0.0) ? map->max_load : HH_MAP_MAX_LOAD;
+    HH_ASSERT(load <= 1.0, "hh_map_t received invalid max_load: %lf", load);
+    return load;
+}
+
+// number of occupied slots (including tombstones) that triggers a rehash
+static size_t
+HH__map_load_limit(const hh_map_t* map, size_t bucket_count) {
+    return (size_t) ((double) bucket_count * HH__map_max_load(map));
+}
+
+// smallest valid table size that holds n entries without exceeding max_load
+// 0 if the size isn't representable, which HH__map_resize rejects
+static size_t
+HH__map_capacity_for(const hh_map_t* map, size_t n) {
+    size_t cap = HH__MAP_GROUP_WIDTH;
+    while(HH__map_load_limit(map, cap) < n) {
+        if(cap > SIZE_MAX / 2) return 0;
+        cap *= 2;
+    }
+    return cap;
+}
+
+// places an existing entry into a free slot of the current table
+static void
+HH__map_place(hh_map_t* map, char* entry_begin) {
+    size_t hash = HH__MAP_ENTRY_HASH(entry_begin);
+    size_t idx = HH__map_find_free(HH__MAP_TABLE(map), hash);
+    HH_ASSERT_UNREACHABLE(idx != SIZE_MAX);
+    if(map->ctrl[idx] == HH__MAP_CTRL_DELETED) --(map->deleted);
+    map->ctrl[idx] = HH__MAP_TAG(hash);
+    map->slots[idx] = entry_begin;
+}
+
+// moves up to n slots of the old table into the current one
+// the old table is released once it no longer holds any entries
+static void
+HH__map_migrate(hh_map_t* map, size_t n) {
+    if(map->old.ctrl == NULL) return;
+    for(size_t i; n > 0 && map->old.count > 0; --n) {
+        i = (map->old.migrated)++;
+        if(!HH__MAP_IS_FULL(map->old.ctrl[i])) continue;
+        HH__map_place(map, map->old.slots[i]);
+        // migrated slots become tombstones so that the remaining entries stay reachable
+        map->old.ctrl[i] = HH__MAP_CTRL_DELETED;
+        map->old.slots[i] = NULL;
+        --(map->old.count);
+    }
+    if(map->old.count > 0) return;
+    free(map->old.ctrl);
+    free(map->old.slots);
+    memset(&map->old, 0, sizeof(map->old));
+}
+
+// moves all entries into a newly allocated table with bucket_count slots
+// entries themselves are never copied, only their slot pointers
+// incremental maps keep the previous table around and migrate it gradually
+static _Bool
+HH__map_resize(hh_map_t* map, size_t bucket_count) {
+    // HH__map_capacity and HH__map_capacity_for return 0 on overflow
+    if(bucket_count == 0) return 0;
+    HH_ASSERT_UNREACHABLE(bucket_count % HH__MAP_GROUP_WIDTH == 0);
+    uint8_t* ctrl = malloc(bucket_count);
+    char** slots = calloc(bucket_count, sizeof(char*));
+    if(ctrl == NULL || slots == NULL) {
+        free(ctrl);
+        free(slots);
+        return 0;
+    }
+    memset(ctrl, HH__MAP_CTRL_EMPTY, bucket_count);
+    // at most one table can be migrating at a time
+    HH__map_migrate(map, SIZE_MAX);
+    HH__map_table old = HH__MAP_TABLE(map);
+    map->bucket_count = bucket_count;
+    map->deleted = 0;
+    map->ctrl = ctrl;
+    map->slots = slots;
+    if(old.ctrl == NULL) return 1;
+    if(map->incremental && map->count > 0) {
+        map->old.bucket_count = old.bucket_count;
+        map->old.count = map->count;
+        map->old.migrated = 0;
+        map->old.ctrl = old.ctrl;
+        map->old.slots = old.slots;
+        return 1;
+    }
+    for(size_t i = 0; i < old.bucket_count; ++i) {
+        if(HH__MAP_IS_FULL(old.ctrl[i])) HH__map_place(map, old.slots[i]);
+    }
+    free(old.ctrl);
+    free(old.slots);
+    return 1;
+}
+
+// frees the entry in the given slot
+static void
+HH__map_erase(hh_map_t* map, HH__map_table table, size_t idx) {
+    HH__map_entry_release(map, table.slots[idx]);
+    table.slots[idx] = NULL;
+    // if the group already has an empty slot, no probe sequence continues past it,
+    // so this slot can be emptied as well, otherwise a tombstone keeps the chain intact
+    const uint8_t* group = table.ctrl + (idx & ~((size_t) HH__MAP_GROUP_WIDTH - 1));
+    table.ctrl[idx] = HH__map_group_match(group, HH__MAP_CTRL_EMPTY) ? 
+        HH__MAP_CTRL_EMPTY : 
+        HH__MAP_CTRL_DELETED;
+    if(table.ctrl != map->ctrl) --(map->old.count);
+    else if(table.ctrl[idx] == HH__MAP_CTRL_DELETED) ++(map->deleted);
+    --(map->count);
+}
+
+// copies a value into an entry (0-initializing it if val is NULL), val may overlap val_start
+static char*
+HH__map_entry_fill(char* val_start, const void* val, size_t size_val) {
+    if(val == NULL) memset(val_start, 0, size_val);
+    else memmove(val_start, val, size_val);
+    return val_start;
+}
+
+// shared implementation of all insertion functions
+// returns the value of the entry matching key, creating it with size_val bytes if it doesn't exist,
+// when overwrite is set, the size of an existing value is changed to size_val
+// new values, and existing ones when overwrite is set, are copied from val (0-initialized if NULL),
+// the copy is made before an old entry is released, so val may point into it
+static char*
+HH__map_emplace(hh_map_t* map, size_t hash, const void* key, size_t size_key, const void* val, size_t size_val, _Bool overwrite, _Bool* inserted) {
+    if(map == NULL) return NULL;
+    // initialize map
+    if(map->ctrl == NULL && !HH__map_resize(map, HH__map_capacity(map->bucket_count))) return NULL;
+    HH__map_migrate(map, HH_MAP_REHASH_STEP);
+    // a single probe either finds the key or the slot it should be inserted into
+    size_t idx_free;
+    HH__map_table table;
+    size_t idx = HH__map_locate(map, hash, key, size_key, &table, &idx_free);
+    char* entry_begin;
+    if(idx != SIZE_MAX) {
+        *inserted = 0;
+        entry_begin = table.slots[idx];
+        hh_map_entry_t entry = HH__map_entry_unpack(map->compact, entry_begin);
+        if(!overwrite) return (char*) entry.val;
+        if(entry.size_val == size_val) return HH__map_entry_fill((char*) entry.val, val, size_val);
+        // the header of a compact entry may change length, so the entry is rebuilt
+        entry_begin = HH__map_entry_alloc(map, hash, entry.key, entry.size_key, size_val);
+        if(entry_begin == NULL) return NULL;
+        char* val_start = HH__map_entry_fill((char*) HH__map_entry_unpack(map->compact, entry_begin).val, val, size_val);
+        HH__map_entry_release(map, table.slots[idx]);
+        table.slots[idx] = entry_begin;
+        return val_start;
+    }
+    // rehash first if the load limit would be exceeded
+    // when most occupied slots are tombstones, this rehashes without growing
+    if(map->count + map->deleted + 1 > HH__map_load_limit(map, map->bucket_count)) {
+        size_t n = map->count + 1;
+        // leave enough room for an incremental rehash to finish before the next one
+        if(map->incremental) n += map->bucket_count / HH_MAP_REHASH_STEP + 1;
+        if(!HH__map_resize(map, HH__map_capacity_for(map, n))) return NULL;
+        idx_free = HH__map_find_free(HH__MAP_TABLE(map), hash);
+    }
+    HH_ASSERT_UNREACHABLE(idx_free != SIZE_MAX);
+    // build the entry
+    entry_begin = HH__map_entry_alloc(map, hash, key, size_key, size_val);
+    if(entry_begin == NULL) return NULL;
+    // claim the slot
+    if(map->ctrl[idx_free] == HH__MAP_CTRL_DELETED) --(map->deleted);
+    map->ctrl[idx_free] = HH__MAP_TAG(hash);
+    map->slots[idx_free] = entry_begin;
+    ++(map->count);
+    *inserted = 1;
+    return HH__map_entry_fill(entry_begin + HH__map_entry_header(map->compact, size_key, size_val) + size_key, val, size_val);
+}
+
 _Bool
 hh_map_insert(hh_map_t* map, const void* key, size_t size_key, const void* val, size_t size_val) {
-    if(map == NULL) return 0;
-    // initialize map
-    if(map->buckets == NULL) {
-        map->buckets = calloc(map->bucket_count, sizeof(char*));
-        if(map->buckets == NULL) return 0;
-        for(size_t i = 0; i < map->bucket_count; ++i) hh_darradd(map->buckets[i], sizeof(size_t) * 2);
-    }
-    hh_map_remove(map, key, size_key);
-    // perform insertion
-    size_t idx, len;
-    idx = HH__map_hash_generic(map, key, size_key);
-    len = hh_darrlen(map->buckets[idx]);
-    hh_darradd(map->buckets[idx], size_key + size_val + sizeof(size_t) * 2);
-    // update entry sizes
-    size_t* meta = (((size_t*) (map->buckets[idx] + len)) - 2);
-    HH_ASSERT_UNREACHABLE(meta[0] == 0 && meta[1] == 0);
-    *(meta++) = size_key;
-    *(meta++) = size_val;
-    // copy over entry
-    memcpy(meta, key, size_key);
-    char* val_start = ((char*) meta) + size_key;
-    if(val == NULL) memset(val_start, 0, size_val);
-    else memcpy(val_start, val, size_val);
-    return 1;
+    return hh_map_upsert(map, key, size_key, val, size_val, NULL) != NULL;
+}
+
+// hh_map_upsert with a precomputed hash
+static void*
+HH__map_upsert(hh_map_t* map, size_t hash, const void* key, size_t size_key, const void* val, size_t size_val, _Bool* inserted) {
+    _Bool inserted_temp;
+    char* val_start = HH__map_emplace(map, hash, key, size_key, val, size_val, 1, &inserted_temp);
+    if(val_start == NULL) return NULL;
+    if(inserted != NULL) *inserted = inserted_temp;
+    return val_start;
+}
+
+void*
+hh_map_upsert(hh_map_t* map, const void* key, size_t size_key, const void* val, size_t size_val, _Bool* inserted) {
+    if(map == NULL) return NULL;
+    return HH__map_upsert(map, HH__map_hash_generic(map, key, size_key), key, size_key, val, size_val, inserted);
+}
+
+void*
+hh_map_get_or_insert(hh_map_t* map, const void* key, size_t size_key, size_t size_val, _Bool* inserted) {
+    if(map == NULL) return NULL;
+    _Bool inserted_temp;
+    char* val_start = HH__map_emplace(map, HH__map_hash_generic(map, key, size_key), 
+        key, size_key, NULL, size_val, 0, &inserted_temp);
+    if(val_start == NULL) return NULL;
+    if(inserted != NULL) *inserted = inserted_temp;
+    return val_start;
 }
 
 _Bool
@@ -1139,25 +2877,22 @@ hh_map_insert_entry(hh_map_t* map, const hh_map_entry_t* entry) {
     return hh_map_insert(map, entry->key, entry->size_key, entry->val, entry->size_val);
 }
 
+// hh_map_get with a precomputed hash, the map must be initialized
+// this never advances an incremental rehash
+static hh_map_entry_t
+HH__map_get(const hh_map_t* map, size_t hash, const void* key, size_t size_key) {
+    HH__map_table table;
+    size_t idx = HH__map_locate(map, hash, key, size_key, &table, NULL);
+    if(idx == SIZE_MAX) return (hh_map_entry_t) {0};
+    return HH__map_entry_unpack(map->compact, table.slots[idx]);
+}
+
 hh_map_entry_t
 hh_map_get(const hh_map_t* map, const void* key, size_t size_key) {
     if(map == NULL) return (hh_map_entry_t) {0};
-    if(map->buckets == NULL) return (hh_map_entry_t) {0};
+    if(map->ctrl == NULL) return (hh_map_entry_t) {0};
     if(key == NULL) return (hh_map_entry_t) {0};
-    // get correct bucket
-    size_t idx = HH__map_hash_generic(map, key, size_key);
-    // step through the bucket
-    hh_map_entry_t entry;
-    for(size_t i = 0; i < hh_darrlen(map->buckets[idx]);) {
-        entry.size_key = *((size_t*) (map->buckets[idx] + i)); i += sizeof(size_t);
-        entry.size_val = *((size_t*) (map->buckets[idx] + i)); i += sizeof(size_t);
-        entry.key = map->buckets[idx] + i; i += entry.size_key;
-        entry.val = map->buckets[idx] + i; i += entry.size_val;
-        // return if key was found
-        if(HH__map_comp_generic(map, key, size_key, entry.key, entry.size_key) == 0) 
-            return entry;
-    }
-    return (hh_map_entry_t) {0};
+    return HH__map_get(map, HH__map_hash_generic(map, key, size_key), key, size_key);
 }
 
 const void*
@@ -1165,92 +2900,954 @@ hh_map_get_val(const hh_map_t* map, const void* key, size_t size_key) {
     return hh_map_get(map, key, size_key).val;
 }
 
+size_t
+hh_map_get_many(const hh_map_t* map, const void* const* keys, const size_t* sizes, size_t n, hh_map_entry_t* out) {
+    if(n == 0) return 0;
+    memset(out, 0, sizeof(hh_map_entry_t) * n);
+    if(map == NULL) return 0;
+    if(map->ctrl == NULL) return 0;
+    size_t found = 0, hashes[HH_MAP_BATCH], mask = map->bucket_count / HH__MAP_GROUP_WIDTH - 1;
+    size_t batch, i, group, idx;
+    uint32_t match;
+    HH__map_table table;
+    for(; n > 0; n -= batch, keys += batch, sizes += batch, out += batch) {
+        batch = HH_MIN(n, (size_t) HH_MAP_BATCH);
+        // hash the batch and prefetch the first group each key will probe
+        for(i = 0; i < batch; ++i) {
+            if(keys[i] == NULL) continue;
+            hashes[i] = HH__map_hash_generic(map, keys[i], sizes[i]);
+            group = ((hashes[i] >> 7) & mask) * HH__MAP_GROUP_WIDTH;
+            HH__PREFETCH(map->ctrl + group);
+            HH__PREFETCH(map->slots + group);
+        }
+        // the control bytes are cached by now, prefetch the first candidate entry of each key
+        for(i = 0; i < batch; ++i) {
+            if(keys[i] == NULL) continue;
+            group = ((hashes[i] >> 7) & mask) * HH__MAP_GROUP_WIDTH;
+            match = HH__map_group_match(map->ctrl + group, HH__MAP_TAG(hashes[i]));
+            if(match) HH__PREFETCH(map->slots[group + HH__map_ctz(match)]);
+        }
+        // resolve the batch
+        for(i = 0; i < batch; ++i) {
+            if(keys[i] == NULL) continue;
+            idx = HH__map_locate(map, hashes[i], keys[i], sizes[i], &table, NULL);
+            if(idx == SIZE_MAX) continue;
+            out[i] = HH__map_entry_unpack(map->compact, table.slots[idx]);
+            ++found;
+        }
+    }
+    return found;
+}
+
+// hh_map_remove with a precomputed hash
+static _Bool
+HH__map_remove(hh_map_t* map, size_t hash, const void* key, size_t size_key) {
+    if(map->ctrl == NULL) return 0;
+    HH__map_migrate(map, HH_MAP_REHASH_STEP);
+    HH__map_table table;
+    size_t idx = HH__map_locate(map, hash, key, size_key, &table, NULL);
+    if(idx == SIZE_MAX) return 0;
+    HH__map_erase(map, table, idx);
+    return 1;
+}
+
 _Bool
 hh_map_remove(hh_map_t* map, const void* key, size_t size_key) {
-    // get corresponding entry
-    hh_map_entry_t entry = hh_map_get(map, key, size_key);
-    if(entry.val == NULL) return 0;
-    // recompute bucket
-    size_t idx = HH__map_hash_generic(map, key, size_key);
-    char* bucket = map->buckets[idx];
-    size_t len = hh_darrlen(bucket);
-    // entry bounds
-    char* entry_begin = (char*) entry.key - sizeof(size_t) * 2;
-    char* entry_end = (char*) entry.val + entry.size_val;
-    // remaining bytes to slide over the current entry
-    size_t tail = (size_t) ((bucket + len) - entry_end);
-    memmove(entry_begin, entry_end, tail);
-    // update hh_darrheader_t length to reflect changes
-    hh_darrheader(bucket)->len -= (entry.size_key + entry.size_val + sizeof(size_t) * 2);
-    return 1;
+    if(map == NULL) return 0;
+    if(key == NULL) return 0;
+    return HH__map_remove(map, HH__map_hash_generic(map, key, size_key), key, size_key);
 }
 
+_Bool
+hh_map_reserve(hh_map_t* map, size_t n) {
+    if(map == NULL) return 0;
+    size_t bucket_count = HH__map_capacity_for(map, n);
+    if(map->ctrl == NULL) {
+        size_t hint = HH__map_capacity(map->bucket_count);
+        return bucket_count != 0 && hint != 0 && HH__map_resize(map, HH_MAX(bucket_count, hint));
+    }
+    if(bucket_count == 0) return 0;
+    if(bucket_count <= map->bucket_count) return 1;
+    return HH__map_resize(map, bucket_count);
+}
+
+// state shared by the phases of hh_map_build, each thread receives its own copy
+// `counts` is an nthreads x nthreads matrix, row t holds the size of each partition within chunk t,
+// which later becomes the position chunk t scatters each partition to
+struct HH__map_build {
+    hh_map_t* map;
+    const hh_map_entry_t* entries;
+    size_t n, nthreads, id;
+    size_t* hashes;
+    size_t* counts;
+    size_t* order;
+    size_t* partitions;
+    size_t** overflow;
+    size_t inserted;
+    _Bool ok;
+};
+
+// partitions are contiguous ranges of groups
+static size_t
+HH__map_build_partition(const struct HH__map_build* build, size_t hash) {
+    size_t group_count = build->map->bucket_count / HH__MAP_GROUP_WIDTH;
+    return ((hash >> 7) & (group_count - 1)) * build->nthreads / group_count;
+}
+
+// hashes chunk `id` and counts the entries that fall into each partition
+static void
+HH__map_build_hash(void* arg) {
+    struct HH__map_build* build = arg;
+    size_t* counts = build->counts + build->id * build->nthreads;
+    for(size_t i = build->id * build->n / build->nthreads; i < (build->id + 1) * build->n / build->nthreads; ++i) {
+        build->hashes[i] = HH__map_hash_generic(build->map, build->entries[i].key, build->entries[i].size_key);
+        ++counts[HH__map_build_partition(build, build->hashes[i])];
+    }
+}
+
+// scatters chunk `id` into the partitions, preserving the order of the entries
 static void
-HH__map_it_helper(hh_map_entry_t* entry, const char* entry_begin) {
-    entry->size_key = ((size_t*) entry_begin)[0];
-    entry->size_val = ((size_t*) entry_begin)[1];
-    entry->key = (const void*) (((size_t*) entry_begin) + 2);
-    entry->val = (const char*) entry->key + entry->size_key;
+HH__map_build_scatter(void* arg) {
+    struct HH__map_build* build = arg;
+    size_t* offsets = build->counts + build->id * build->nthreads;
+    for(size_t i = build->id * build->n / build->nthreads; i < (build->id + 1) * build->n / build->nthreads; ++i)
+        build->order[offsets[HH__map_build_partition(build, build->hashes[i])]++] = i;
 }
 
-hh_map_entry_t
-HH__map_it_begin(const hh_map_t* map) {
+// inserts partition `id` into the table, probing only each key's home group,
+// which lies within the partition, so threads never touch the same slots
+// keys whose home group is full are deferred to build->overflow[id]
+static void
+HH__map_build_fill(void* arg) {
+    struct HH__map_build* build = arg;
+    hh_map_t* map = build->map;
+    size_t mask = map->bucket_count / HH__MAP_GROUP_WIDTH - 1, hash, group, idx;
+    hh_map_entry_t found;
+    char* entry_begin;
+    for(size_t k = build->partitions[build->id]; k < build->partitions[build->id + 1]; ++k) {
+        const hh_map_entry_t* entry = &build->entries[build->order[k]];
+        hash = build->hashes[build->order[k]];
+        group = ((hash >> 7) & mask) * HH__MAP_GROUP_WIDTH;
+        idx = SIZE_MAX;
+        for(uint32_t match = HH__map_group_match(map->ctrl + group, HH__MAP_TAG(hash)); match; match &= match - 1) {
+            if(HH__MAP_ENTRY_HASH(map->slots[group + HH__map_ctz(match)]) != hash) continue;
+            found = HH__map_entry_unpack(map->compact, map->slots[group + HH__map_ctz(match)]);
+            if(HH__map_comp_generic(map, entry->key, entry->size_key, found.key, found.size_key) != 0) continue;
+            idx = group + HH__map_ctz(match);
+            break;
+        }
+        if(idx == SIZE_MAX) {
+            // the table starts out empty and nothing is removed, so there are no tombstones
+            uint32_t match = HH__map_group_match(map->ctrl + group, HH__MAP_CTRL_EMPTY);
+            if(match == 0) {
+                hh_darrput(build->overflow[build->id], build->order[k]);
+                continue;
+            }
+            idx = group + HH__map_ctz(match);
+            entry_begin = HH__map_entry_alloc(map, hash, entry->key, entry->size_key, entry->size_val);
+            if(entry_begin == NULL) { build->ok = 0; return; }
+            map->ctrl[idx] = HH__MAP_TAG(hash);
+            map->slots[idx] = entry_begin;
+            ++(build->inserted);
+        } else if(found.size_val != entry->size_val) {
+            // an earlier duplicate is overwritten, exactly as HH__map_emplace would
+            entry_begin = HH__map_entry_alloc(map, hash, entry->key, entry->size_key, entry->size_val);
+            if(entry_begin == NULL) { build->ok = 0; return; }
+            HH__map_entry_release(map, map->slots[idx]);
+            map->slots[idx] = entry_begin;
+        }
+        found = HH__map_entry_unpack(map->compact, map->slots[idx]);
+        if(entry->val == NULL) memset((char*) found.val, 0, entry->size_val);
+        else memcpy((char*) found.val, entry->val, entry->size_val);
+    }
+}
+
+// runs fn on every copy of the build state, one thread each
+// the calling thread takes the first copy, along with any whose thread couldn't be started
+static void
+HH__map_build_run(struct HH__map_build* builds, void (*fn)(void*)) {
+    size_t nthreads = builds[0].nthreads, started = 1;
+#ifdef HH_MAP_THREADS
+    HH__thread* threads = malloc(sizeof(HH__thread) * nthreads);
+    while(threads != NULL && started < nthreads && HH__thread_start(&threads[started], fn, &builds[started])) ++started;
+#endif // HH_MAP_THREADS
+    fn(&builds[0]);
+    for(size_t t = started; t < nthreads; ++t) fn(&builds[t]);
+#ifdef HH_MAP_THREADS
+    for(size_t t = 1; t < started; ++t) HH__thread_join(&threads[t]);
+    free(threads);
+#endif // HH_MAP_THREADS
+}
+
+_Bool
+hh_map_build(hh_map_t* map, const hh_map_entry_t* entries, size_t n, size_t nthreads) {
+    if(map == NULL) return 0;
+    if(n == 0) return 1;
+    if(entries == NULL) return 0;
+    if(map->count > 0 || map->storage != NULL) {
+        for(size_t i = 0; i < n; ++i) if(!hh_map_insert_entry(map, &entries[i])) return 0;
+        return 1;
+    }
+    // start from a table that holds every entry without rehashing, and has no tombstones
+    size_t bucket_count = HH__map_capacity_for(map, n), hint = HH__map_capacity(map->bucket_count);
+    if(bucket_count == 0 || hint == 0) return 0;
+    bucket_count = HH_MAX(bucket_count, hint);
+    if((map->ctrl == NULL || map->deleted > 0 || map->bucket_count < bucket_count) && 
+        !HH__map_resize(map, bucket_count)) return 0;
+#ifdef HH_MAP_THREADS
+    if(nthreads == 0) nthreads = HH__thread_count();
+#else
+    nthreads = 1;
+#endif // HH_MAP_THREADS
+    // partitions narrower than a few groups aren't worth a thread
+    nthreads = HH_MAX(HH_MIN(nthreads, map->bucket_count / (HH__MAP_GROUP_WIDTH * 64)), 1);
+    struct HH__map_build* builds = calloc(nthreads, sizeof(struct HH__map_build));
+    size_t* hashes = malloc(sizeof(size_t) * n);
+    size_t* order = malloc(sizeof(size_t) * n);
+    size_t* counts = calloc(nthreads * nthreads, sizeof(size_t));
+    size_t* partitions = calloc(nthreads + 1, sizeof(size_t));
+    size_t** overflow = calloc(nthreads, sizeof(size_t*));
+    _Bool ok = builds != NULL && hashes != NULL && order != NULL && counts != NULL && partitions != NULL && overflow != NULL;
+    size_t t, p, offset = 0;
+    for(t = 0; ok && t < nthreads; ++t) {
+        builds[t] = (struct HH__map_build) {
+            .map = map, .entries = entries, .n = n, .nthreads = nthreads, .id = t,
+            .hashes = hashes, .counts = counts, .order = order, 
+            .partitions = partitions, .overflow = overflow, .ok = 1
+        };
+    }
+    if(ok) HH__map_build_run(builds, HH__map_build_hash);
+    // turn the counts into scatter positions, partition by partition, chunk by chunk
+    for(p = 0; ok && p < nthreads; ++p) {
+        partitions[p] = offset;
+        for(t = 0; t < nthreads; ++t) {
+            size_t count = counts[t * nthreads + p];
+            counts[t * nthreads + p] = offset;
+            offset += count;
+        }
+    }
+    if(ok) {
+        partitions[nthreads] = n;
+        HH__map_build_run(builds, HH__map_build_scatter);
+        HH__map_build_run(builds, HH__map_build_fill);
+    }
+    for(t = 0; builds != NULL && t < nthreads; ++t) {
+        ok = ok && builds[t].ok;
+        map->count += builds[t].inserted;
+    }
+    // deferred keys are inserted in their original order, so the last duplicate still wins
+    for(t = 0; ok && t < nthreads; ++t) {
+        for(size_t k = 0; ok && k < hh_darrlen(overflow[t]); ++k) {
+            const hh_map_entry_t* entry = &entries[overflow[t][k]];
+            ok = HH__map_upsert(map, hashes[overflow[t][k]], entry->key, entry->size_key, entry->val, entry->size_val, NULL) != NULL;
+        }
+    }
+    if(!ok) {
+        // the map started out empty, so discarding everything makes the build all-or-nothing
+        hh_map_free_f free_key = map->free_key, free_val = map->free_val;
+        map->free_key = map->free_val = NULL;
+        hh_map_free(map);
+        map->free_key = free_key;
+        map->free_val = free_val;
+    }
+    for(t = 0; overflow != NULL && t < nthreads; ++t) hh_darrfree(overflow[t]);
+    free(builds);
+    free(hashes);
+    free(order);
+    free(counts);
+    free(partitions);
+    free(overflow);
+    return ok;
+}
+
+// moves the iterator to the first occupied slot at or after it->idx
+// iteration visits the old table before the current one,
+// entries live in exactly one of them so each is seen once
+static void
+HH__map_it_seek(hh_map_it_t* it) {
+    HH__map_table table;
     hh_map_entry_t entry;
-    size_t idx;
-    // scan all buckets until a non-empty one is found
-    for(idx = 0; idx < map->bucket_count; ++idx) {
-        // a non-empty bucket is longer than the terminating 0, 0
-        if(hh_darrlen(map->buckets[idx]) > sizeof(size_t) * 2) {
-            HH__map_it_helper(&entry, map->buckets[idx]);
-            return entry;
+    for(;;) {
+        table = it->old ? HH__MAP_TABLE_OLD(it->map) : HH__MAP_TABLE(it->map);
+        for(; it->idx < table.bucket_count; ++(it->idx)) {
+            // skip over groups without a single occupied slot
+            if(it->idx % HH__MAP_GROUP_WIDTH == 0 && 
+                HH__map_group_match_free(table.ctrl + it->idx) == 0xFFFF) {
+                it->idx += HH__MAP_GROUP_WIDTH - 1;
+                continue;
+            }
+            if(!HH__MAP_IS_FULL(table.ctrl[it->idx])) continue;
+            entry = HH__map_entry_unpack(it->map->compact, table.slots[it->idx]);
+            it->size_key = entry.size_key;
+            it->size_val = entry.size_val;
+            it->key = entry.key;
+            it->val = entry.val;
+            return;
         }
+        if(!it->old) break;
+        it->old = 0;
+        it->idx = 0;
     }
-    // bucket is empty
-    return (hh_map_entry_t) {0};
+    it->size_key = it->size_val = 0;
+    it->key = it->val = NULL;
+}
+
+// the entry the iterator currently points to
+static const char*
+HH__map_it_entry(const hh_map_it_t* it) {
+    return (it->old ? it->map->old.slots : it->map->slots)[it->idx];
+}
+
+hh_map_it_t
+HH__map_it_begin(const hh_map_t* map) {
+    hh_map_it_t it = { .map = map, .old = (map->old.ctrl != NULL) };
+    if(map->ctrl != NULL) HH__map_it_seek(&it);
+    return it;
 }
 
 void
-HH__map_it_next(const hh_map_t* map, hh_map_entry_t* entry) {
-    char* entry_begin;
-    size_t idx;
-    // compute the bucket index of the entry
-    idx = HH__map_hash_generic(map, entry->key, entry->size_key);
-    // look for the next entry in the same bucket
-    entry_begin = ((char*) entry->val) + entry->size_val;
-    if(entry_begin + sizeof(size_t) * 2 <= map->buckets[idx] + hh_darrlen(map->buckets[idx])) {
-        size_t size_key = ((size_t*) entry_begin)[0];
-        if(size_key != 0) goto found;
-    }
-    // scan remaining buckets if we didn't find another element in the previous one
-    for(++idx; idx < map->bucket_count; ++idx) {
-        entry_begin = map->buckets[idx];
-        if(hh_darrlen(map->buckets[idx]) > sizeof(size_t) * 2) goto found;
-    }
-    // end of iteration
-    memset(entry, 0, sizeof(hh_map_entry_t));
-    return;
-    // continued iteration
-found:
-    HH__map_it_helper(entry, entry_begin);
-    return;
+HH__map_it_next(hh_map_it_t* it) {
+    ++(it->idx);
+    HH__map_it_seek(it);
+}
+
+void
+hh_map_it_remove(hh_map_it_t* it) {
+    HH_ASSERT(it->val != NULL, "hh_map_it_remove received an exhausted iterator");
+    hh_map_t* map = (hh_map_t*) it->map;
+    HH__map_erase(map, it->old ? HH__MAP_TABLE_OLD(map) : HH__MAP_TABLE(map), it->idx);
+}
+
+static void
+HH__map_free_table(const hh_map_t* map, HH__map_table table) {
+    hh_map_entry_t entry;
+    for(size_t i = 0; i < table.bucket_count; ++i) {
+        if(!HH__MAP_IS_FULL(table.ctrl[i])) continue;
+        entry = HH__map_entry_unpack(map->compact, table.slots[i]);
+        if(map->free_key) (map->free_key)(entry.key, entry.size_key);
+        if(map->free_val) (map->free_val)(entry.val, entry.size_val);
+        HH__map_entry_release(map, table.slots[i]);
+    }
+    free(table.ctrl);
+    free(table.slots);
 }
 
 void
 hh_map_free(hh_map_t* map) {
+    if(map->ctrl == NULL) return;
+    if(map->old.ctrl != NULL) HH__map_free_table(map, HH__MAP_TABLE_OLD(map));
+    HH__map_free_table(map, HH__MAP_TABLE(map));
+    memset(&map->old, 0, sizeof(map->old));
+    map->count = 0;
+    map->deleted = 0;
+    map->ctrl = NULL;
+    map->slots = NULL;
+}
+
+#ifdef HH_MAP_THREADS
+struct HH__map_shard {
+    HH__rwlock lock;
+    hh_map_t map;
+    // keeps the locks of neighbouring shards on separate cache lines
+    char pad[64];
+};
+
+_Bool
+hh_map_concurrent_init(hh_map_concurrent_t* map) {
+    if(map == NULL) return 0;
+    HH_ASSERT(map->shards == NULL, "hh_map_concurrent_init received an initialized map");
+    HH_ASSERT(map->init.storage == NULL, "hh_map_concurrent_t shards can't share an arena");
+    size_t shard_count = (map->shard_count == 0) ? HH_MAP_SHARD_COUNT : map->shard_count;
+    map->shard_count = 1;
+    map->shard_bits = 0;
+    while(map->shard_count < shard_count) {
+        if(map->shard_count > SIZE_MAX / 2) return 0;
+        map->shard_count *= 2;
+        ++(map->shard_bits);
+    }
+    map->shards = calloc(map->shard_count, sizeof(struct HH__map_shard));
+    if(map->shards == NULL) return 0;
+    for(size_t i = 0; i < map->shard_count; ++i) {
+        map->shards[i].map = map->init;
+        if(HH__rwlock_init(&map->shards[i].lock)) continue;
+        while(i-- > 0) HH__rwlock_destroy(&map->shards[i].lock);
+        free(map->shards);
+        map->shards = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// shards are selected with the high bits of the hash after a multiplicative (Fibonacci) mix,
+// so custom hashes that only vary in their low bits (like the identity of an integer) still spread out,
+// the low bits of the unmixed hash are used by each shard's table
+static struct HH__map_shard*
+HH__map_concurrent_shard(const hh_map_concurrent_t* map, size_t hash) {
+    HH_ASSERT(map->shards != NULL, "hh_map_concurrent_t was not initialized");
+    if(map->shard_bits == 0) return map->shards;
+    return &map->shards[(size_t) (((uint64_t) hash * 0x9E3779B97F4A7C15ull) >> (64 - map->shard_bits))];
+}
+
+_Bool
+hh_map_concurrent_insert(hh_map_concurrent_t* map, const void* key, size_t size_key, const void* val, size_t size_val) {
+    if(map == NULL) return 0;
+    size_t hash = HH__map_hash_generic(&map->init, key, size_key);
+    struct HH__map_shard* shard = HH__map_concurrent_shard(map, hash);
+    HH__rwlock_write(&shard->lock);
+    _Bool result = HH__map_upsert(&shard->map, hash, key, size_key, val, size_val, NULL) != NULL;
+    HH__rwlock_write_end(&shard->lock);
+    return result;
+}
+
+_Bool
+hh_map_concurrent_get(const hh_map_concurrent_t* map, const void* key, size_t size_key, void* val, size_t size_val) {
+    if(map == NULL) return 0;
+    if(key == NULL) return 0;
+    size_t hash = HH__map_hash_generic(&map->init, key, size_key);
+    struct HH__map_shard* shard = HH__map_concurrent_shard(map, hash);
+    hh_map_entry_t entry = {0};
+    HH__rwlock_read(&shard->lock);
+    if(shard->map.ctrl != NULL) entry = HH__map_get(&shard->map, hash, key, size_key);
+    if(entry.val != NULL && val != NULL) memcpy(val, entry.val, HH_MIN(size_val, entry.size_val));
+    HH__rwlock_read_end(&shard->lock);
+    return entry.val != NULL;
+}
+
+_Bool
+hh_map_concurrent_remove(hh_map_concurrent_t* map, const void* key, size_t size_key) {
+    if(map == NULL) return 0;
+    if(key == NULL) return 0;
+    size_t hash = HH__map_hash_generic(&map->init, key, size_key);
+    struct HH__map_shard* shard = HH__map_concurrent_shard(map, hash);
+    HH__rwlock_write(&shard->lock);
+    _Bool result = HH__map_remove(&shard->map, hash, key, size_key);
+    HH__rwlock_write_end(&shard->lock);
+    return result;
+}
+
+size_t
+hh_map_concurrent_count(const hh_map_concurrent_t* map) {
+    size_t count = 0;
+    for(size_t i = 0; map->shards != NULL && i < map->shard_count; ++i) {
+        HH__rwlock_read(&map->shards[i].lock);
+        count += map->shards[i].map.count;
+        HH__rwlock_read_end(&map->shards[i].lock);
+    }
+    return count;
+}
+
+void
+hh_map_concurrent_free(hh_map_concurrent_t* map) {
+    if(map->shards == NULL) return;
+    for(size_t i = 0; i < map->shard_count; ++i) {
+        hh_map_free(&map->shards[i].map);
+        HH__rwlock_destroy(&map->shards[i].lock);
+    }
+    free(map->shards);
+    map->shards = NULL;
+}
+#endif // HH_MAP_THREADS
+
+// bijective finalizer (splitmix64), so every hash keeps a distinct probe for each displacement
+static uint64_t
+HH__map_frozen_mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// maps x onto [0, n) with a multiplication instead of a division (Lemire's fast range)
+static size_t
+HH__map_frozen_range(uint64_t x, size_t n) {
+    uint64_t hi = (uint64_t) n;
+    HH__hash_mum(&x, &hi);
+    return (size_t) hi;
+}
+
+static size_t
+HH__map_frozen_bucket(size_t hash, size_t bucket_count) {
+    return HH__map_frozen_range(HH__map_frozen_mix((uint64_t) hash), bucket_count);
+}
+
+static size_t
+HH__map_frozen_slot(size_t hash, uint32_t disp, size_t count) {
+    return HH__map_frozen_range(HH__map_frozen_mix((uint64_t) hash + ((uint64_t) disp + 1) * 0x9E3779B97F4A7C15ull), count);
+}
+
+// searches for the displacement of every bucket, largest buckets first,
+// writing the entry that lands in each slot to `placed`
+// `entries` holds the source entries grouped by bucket, bucket i spanning [first[i], first[i + 1])
+static _Bool
+HH__map_frozen_displace(hh_map_frozen_t* frozen, const char** entries, const size_t* first, const char** placed) {
+    size_t size_max = 0, i, j, k, b, size;
+    for(b = 0; b < frozen->bucket_count; ++b) size_max = HH_MAX(size_max, first[b + 1] - first[b]);
+    // occupancy is tracked in a bitmap, which stays cache-resident far longer than `placed`
+    size_t* probe = malloc(sizeof(size_t) * size_max);
+    uint8_t* taken = calloc(frozen->count / 8 + 1, 1);
+    _Bool ok = probe != NULL && taken != NULL;
+    for(size = size_max; ok && size > 0; --size) for(b = 0; ok && b < frozen->bucket_count; ++b) {
+        if(first[b + 1] - first[b] != size) continue;
+        const char** bucket = entries + first[b];
+        // keys that share a full hash would share every slot
+        for(i = 0; ok && i < size; ++i) for(j = 0; ok && j < i; ++j)
+            ok = HH__MAP_ENTRY_HASH(bucket[i]) != HH__MAP_ENTRY_HASH(bucket[j]);
+        for(uint32_t disp = 0; ok; ++disp) {
+            for(i = 0; i < size; ++i) {
+                probe[i] = HH__map_frozen_slot(HH__MAP_ENTRY_HASH(bucket[i]), disp, frozen->count);
+                if(taken[probe[i] / 8] & (1 << (probe[i] % 8))) break;
+                for(k = 0; k < i && probe[k] != probe[i]; ++k);
+                if(k < i) break;
+            }
+            if(i == size) {
+                frozen->disp[b] = disp;
+                for(i = 0; i < size; ++i) {
+                    taken[probe[i] / 8] |= (uint8_t) (1 << (probe[i] % 8));
+                    placed[probe[i]] = bucket[i];
+                }
+                break;
+            }
+            ok = disp < UINT32_MAX;
+        }
+    }
+    free(probe);
+    free(taken);
+    return ok;
+}
+
+// frozen tables whose data reaches 4 GiB need full-width offsets
+static _Bool
+HH__map_frozen_wide(size_t size_data) {
+    return (uint64_t) size_data > UINT32_MAX;
+}
+
+_Bool
+hh_map_freeze(const hh_map_t* map, hh_map_frozen_t* frozen) {
+    if(map == NULL || frozen == NULL) return 0;
+    memset(frozen, 0, sizeof(*frozen));
+    frozen->hash = map->hash;
+    frozen->comp = map->comp;
+    frozen->seed = map->seed;
+    if(map->count == 0) return 1;
+    frozen->count = map->count;
+    frozen->bucket_count = (map->count + HH_MAP_FREEZE_BUCKET_SIZE - 1) / HH_MAP_FREEZE_BUCKET_SIZE;
+    const char** entries = malloc(sizeof(char*) * map->count);
+    const char** placed = calloc(map->count, sizeof(char*));
+    size_t* first = calloc(frozen->bucket_count + 1, sizeof(size_t));
+    frozen->disp = calloc(frozen->bucket_count, sizeof(uint32_t));
+    if(entries == NULL || placed == NULL || first == NULL || frozen->disp == NULL) goto failure;
+    // group the entries by bucket with a counting sort
+    size_t i, b;
+    hh_map_it(map, it) ++first[HH__map_frozen_bucket(HH__MAP_ENTRY_HASH(HH__map_it_entry(&it)), frozen->bucket_count) + 1];
+    for(b = 0; b < frozen->bucket_count; ++b) first[b + 1] += first[b];
+    hh_map_it(map, it) {
+        const char* entry_begin = HH__map_it_entry(&it);
+        entries[first[HH__map_frozen_bucket(HH__MAP_ENTRY_HASH(entry_begin), frozen->bucket_count)]++] = entry_begin;
+    }
+    for(b = frozen->bucket_count; b > 0; --b) first[b] = first[b - 1];
+    first[0] = 0;
+    if(!HH__map_frozen_displace(frozen, entries, first, placed)) goto failure;
+    // entries take the compact layout of hh_map_t, packed without padding
     hh_map_entry_t entry;
-    if(map->buckets == NULL) return;
-    for(size_t i = 0; i < map->bucket_count; ++i) {
-        for(size_t j = 0; j < hh_darrlen(map->buckets[i]);) {
-            entry.size_key = *((size_t*) (map->buckets[i] + j)); j += sizeof(size_t);
-            entry.size_val = *((size_t*) (map->buckets[i] + j)); j += sizeof(size_t);
-            entry.key = map->buckets[i] + j; j += entry.size_key;
-            entry.val = map->buckets[i] + j; j += entry.size_val;
-            if(map->free_key) (map->free_key)(entry.key, entry.size_key);
-            if(map->free_val) (map->free_val)(entry.val, entry.size_val);
+    for(i = 0; i < frozen->count; ++i) {
+        entry = HH__map_entry_unpack(map->compact, placed[i]);
+        frozen->size_data += HH__map_entry_header(1, entry.size_key, entry.size_val) + entry.size_key + entry.size_val;
+    }
+    if(HH__map_frozen_wide(frozen->size_data)) frozen->offsets = malloc(sizeof(size_t) * frozen->count);
+    else frozen->offsets32 = malloc(sizeof(uint32_t) * frozen->count);
+    frozen->data = malloc(frozen->size_data);
+    if((frozen->offsets == NULL && frozen->offsets32 == NULL) || frozen->data == NULL) goto failure;
+    char* entry_begin = frozen->data;
+    for(i = 0; i < frozen->count; ++i) {
+        entry = HH__map_entry_unpack(map->compact, placed[i]);
+        size_t offset = (size_t) (entry_begin - frozen->data);
+        if(frozen->offsets != NULL) frozen->offsets[i] = offset;
+        else frozen->offsets32[i] = (uint32_t) offset;
+        size_t hash = HH__MAP_ENTRY_HASH(placed[i]);
+        memcpy(entry_begin, &hash, sizeof(size_t));
+        entry_begin = HH__map_varint_write(HH__map_varint_write(entry_begin + sizeof(size_t), entry.size_key), entry.size_val);
+        memcpy(entry_begin, entry.key, entry.size_key);
+        memcpy(entry_begin + entry.size_key, entry.val, entry.size_val);
+        entry_begin += entry.size_key + entry.size_val;
+    }
+    free(entries);
+    free(placed);
+    free(first);
+    return 1;
+failure:
+    free(entries);
+    free(placed);
+    free(first);
+    hh_map_frozen_free(frozen);
+    return 0;
+}
+
+hh_map_entry_t
+hh_map_frozen_get(const hh_map_frozen_t* frozen, const void* key, size_t size_key) {
+    if(frozen == NULL) return (hh_map_entry_t) {0};
+    if(frozen->count == 0) return (hh_map_entry_t) {0};
+    if(key == NULL) return (hh_map_entry_t) {0};
+    size_t hash = HH__map_hash_with(frozen->hash, frozen->seed, key, size_key);
+    uint32_t disp = frozen->disp[HH__map_frozen_bucket(hash, frozen->bucket_count)];
+    size_t slot = HH__map_frozen_slot(hash, disp, frozen->count);
+    const char* entry_begin = frozen->data + ((frozen->offsets32 != NULL) ? frozen->offsets32[slot] : frozen->offsets[slot]);
+    // keys that aren't members still land on some slot
+    // entries are unpadded, so the stored hash may be misaligned
+    size_t hash_entry;
+    memcpy(&hash_entry, entry_begin, sizeof(size_t));
+    if(hash_entry != hash) return (hh_map_entry_t) {0};
+    hh_map_entry_t entry = HH__map_entry_unpack(1, entry_begin);
+    if(HH__map_comp_with(frozen->comp, key, size_key, entry.key, entry.size_key) != 0) return (hh_map_entry_t) {0};
+    return entry;
+}
+
+const void*
+hh_map_frozen_get_val(const hh_map_frozen_t* frozen, const void* key, size_t size_key) {
+    return hh_map_frozen_get(frozen, key, size_key).val;
+}
+
+// snapshot files written by hh_map_save have the layout
+// [header, disp (padded to 8 bytes), offsets (padded to 8 bytes), data]
+// offsets are 32-bit when the data is smaller than 4 GiB, exactly as in hh_map_frozen_t
+// the magic number is written in native byte order, so a mismatch also reveals an endianness change
+#define HH__MAP_SNAPSHOT_MAGIC ((uint32_t) 0x50414D48) // "HMAP"
+#define HH__MAP_SNAPSHOT_VERSION ((uint32_t) 2)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size_word;
+    uint64_t seed;
+    uint64_t count;
+    uint64_t bucket_count;
+    uint64_t size_data;
+} HH__map_snapshot_header;
+
+static size_t
+HH__map_snapshot_size_disp(size_t bucket_count) {
+    return (bucket_count * sizeof(uint32_t) + 7) / 8 * 8;
+}
+
+static size_t
+HH__map_snapshot_size_offsets(size_t count, size_t size_data) {
+    size_t size_offset = HH__map_frozen_wide(size_data) ? sizeof(size_t) : sizeof(uint32_t);
+    return (count * size_offset + 7) / 8 * 8;
+}
+
+_Bool
+hh_map_frozen_save(const hh_map_frozen_t* frozen, const char* path) {
+    if(frozen == NULL || path == NULL) return 0;
+    HH__map_snapshot_header header = {
+        .magic = HH__MAP_SNAPSHOT_MAGIC,
+        .version = HH__MAP_SNAPSHOT_VERSION,
+        .size_word = sizeof(size_t),
+        .seed = frozen->seed,
+        .count = frozen->count,
+        .bucket_count = frozen->bucket_count,
+        .size_data = frozen->size_data
+    };
+    static const char pad[8] = {0};
+    size_t size_disp = frozen->bucket_count * sizeof(uint32_t);
+    FILE* fp = fopen(path, "wb");
+    if(fp == NULL) return 0;
+    _Bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    if(ok && frozen->count > 0) {
+        ok = fwrite(frozen->disp, 1, size_disp, fp) == size_disp;
+        size_disp = HH__map_snapshot_size_disp(frozen->bucket_count) - size_disp;
+        ok = ok && fwrite(pad, 1, size_disp, fp) == size_disp;
+        if(frozen->offsets != NULL) ok = ok && fwrite(frozen->offsets, sizeof(size_t), frozen->count, fp) == frozen->count;
+        else ok = ok && fwrite(frozen->offsets32, sizeof(uint32_t), frozen->count, fp) == frozen->count;
+        size_t size_offsets = HH__map_snapshot_size_offsets(frozen->count, frozen->size_data);
+        size_offsets -= frozen->count * (frozen->offsets != NULL ? sizeof(size_t) : sizeof(uint32_t));
+        ok = ok && fwrite(pad, 1, size_offsets, fp) == size_offsets;
+        ok = ok && fwrite(frozen->data, 1, frozen->size_data, fp) == frozen->size_data;
+    }
+    return (fclose(fp) == 0) && ok;
+}
+
+_Bool
+hh_map_save(const hh_map_t* map, const char* path) {
+    hh_map_frozen_t frozen;
+    if(!hh_map_freeze(map, &frozen)) return 0;
+    _Bool ok = hh_map_frozen_save(&frozen, path);
+    hh_map_frozen_free(&frozen);
+    return ok;
+}
+
+static void
+HH__map_unmap(void* mapping, size_t size_mapping) {
+#ifdef _WIN32
+    (void) size_mapping;
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, size_mapping);
+#endif // _WIN32
+}
+
+_Bool
+hh_map_open_mapped(const char* path, hh_map_frozen_t* frozen) {
+    if(path == NULL || frozen == NULL) return 0;
+    memset(frozen, 0, sizeof(*frozen));
+    void* mapping = NULL;
+    size_t size_mapping = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE) return 0;
+    LARGE_INTEGER size;
+    HANDLE view = NULL;
+    if(GetFileSizeEx(file, &size) && (uint64_t) size.QuadPart >= sizeof(HH__map_snapshot_header) && 
+        (uint64_t) size.QuadPart <= SIZE_MAX) {
+        size_mapping = (size_t) size.QuadPart;
+        view = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    // the view keeps the file mapping alive after both handles are closed
+    if(view != NULL) mapping = MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+    if(view != NULL) CloseHandle(view);
+    CloseHandle(file);
+    if(mapping == NULL) return 0;
+#else
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) return 0;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && (uint64_t) st.st_size >= sizeof(HH__map_snapshot_header) && 
+        (uint64_t) st.st_size <= SIZE_MAX) {
+        size_mapping = (size_t) st.st_size;
+        mapping = mmap(NULL, size_mapping, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    // the mapping stays valid after the descriptor is closed
+    close(fd);
+    if(mapping == NULL || mapping == MAP_FAILED) return 0;
+#endif // _WIN32
+    HH__map_snapshot_header header;
+    memcpy(&header, mapping, sizeof(header));
+    _Bool ok = header.magic == HH__MAP_SNAPSHOT_MAGIC && 
+        header.version == HH__MAP_SNAPSHOT_VERSION &&
+        header.size_word == sizeof(size_t) &&
+        header.count <= SIZE_MAX / sizeof(size_t) &&
+        header.size_data <= SIZE_MAX &&
+        header.bucket_count <= header.count &&
+        (header.count == 0 || header.bucket_count > 0);
+    size_t size_disp = ok ? HH__map_snapshot_size_disp((size_t) header.bucket_count) : 0;
+    size_t size_offsets = ok ? HH__map_snapshot_size_offsets((size_t) header.count, (size_t) header.size_data) : 0;
+    size_t size_sections = size_mapping - sizeof(header);
+    ok = ok && size_sections >= size_disp && size_sections - size_disp >= size_offsets && 
+        (uint64_t) (size_sections - size_disp - size_offsets) == header.size_data;
+    if(!ok) {
+        HH__map_unmap(mapping, size_mapping);
+        return 0;
+    }
+    char* base = (char*) mapping + sizeof(header);
+    frozen->seed = header.seed;
+    frozen->count = (size_t) header.count;
+    frozen->bucket_count = (size_t) header.bucket_count;
+    frozen->size_data = (size_t) header.size_data;
+    frozen->disp = (uint32_t*) base;
+    if(HH__map_frozen_wide(frozen->size_data)) frozen->offsets = (size_t*) (base + size_disp);
+    else frozen->offsets32 = (uint32_t*) (base + size_disp);
+    frozen->data = base + size_disp + size_offsets;
+    frozen->mapping = mapping;
+    frozen->size_mapping = size_mapping;
+    return 1;
+}
+
+// returns truthy if both maps produce the same hash for every key
+static _Bool
+HH__map_hash_alike(const hh_map_t* map_a, const hh_map_t* map_b) {
+    return map_a->hash == map_b->hash && (map_a->hash != NULL || map_a->seed == map_b->seed);
+}
+
+// members are always stored compactly, the (empty) value then costs a single byte
+// this must happen before the table is first allocated, since compact can't change afterwards
+static _Bool
+HH__set_init(hh_set_t* set) {
+    if(set->map.ctrl != NULL) return 1;
+    set->map.compact = 1;
+    if(set->map.storage == NULL) {
+        set->keys = calloc(1, sizeof(hh_arena));
+        if(set->keys == NULL) return 0;
+        set->map.storage = set->keys;
+    }
+    return 1;
+}
+
+// adds a member with a precomputed hash, the set must be initialized
+static _Bool
+HH__set_add(hh_set_t* set, size_t hash, const void* key, size_t size_key) {
+    _Bool inserted;
+    return HH__map_emplace(&set->map, hash, key, size_key, NULL, 0, 0, &inserted) != NULL;
+}
+
+// an empty table with the set's configuration, drawing from the same arena
+static hh_map_t
+HH__set_table(const hh_set_t* set) {
+    hh_map_t table = set->map;
+    table.count = 0;
+    table.deleted = 0;
+    table.ctrl = NULL;
+    table.slots = NULL;
+    memset(&table.old, 0, sizeof(table.old));
+    return table;
+}
+
+// swaps the set's table for a rebuilt one
+// members live in the arena, so only the old table's slot arrays are freed
+// like hh_map_it_remove, dropping members doesn't invoke free_key
+static void
+HH__set_replace(hh_set_t* set, const hh_map_t* table) {
+    free(set->map.ctrl);
+    free(set->map.slots);
+    free(set->map.old.ctrl);
+    free(set->map.old.slots);
+    set->map = *table;
+}
+
+_Bool
+hh_set_add(hh_set_t* set, const void* key, size_t size_key) {
+    if(set == NULL) return 0;
+    if(key == NULL) return 0;
+    if(!HH__set_init(set)) return 0;
+    return HH__set_add(set, HH__map_hash_generic(&set->map, key, size_key), key, size_key);
+}
+
+_Bool
+hh_set_has(const hh_set_t* set, const void* key, size_t size_key) {
+    if(set == NULL) return 0;
+    return hh_map_get(&set->map, key, size_key).key != NULL;
+}
+
+_Bool
+hh_set_del(hh_set_t* set, const void* key, size_t size_key) {
+    if(set == NULL) return 0;
+    return hh_map_remove(&set->map, key, size_key);
+}
+
+_Bool
+hh_set_union(hh_set_t* set, const hh_set_t* other) {
+    if(set == NULL || other == NULL) return 0;
+    if(set == other || other->map.count == 0) return 1;
+    if(!HH__set_init(set)) return 0;
+    _Bool alike = HH__map_hash_alike(&set->map, &other->map);
+    size_t hash;
+    // either probe `set` for the members of `other`...
+    if(set->map.count >= other->map.count) {
+        if(!hh_map_reserve(&set->map, set->map.count + other->map.count)) return 0;
+        hh_set_it(other, it) {
+            hash = alike ? 
+                HH__MAP_ENTRY_HASH(HH__map_it_entry(&it)) : 
+                HH__map_hash_generic(&set->map, it.key, it.size_key);
+            if(!HH__set_add(set, hash, it.key, it.size_key)) return 0;
+        }
+        return 1;
+    }
+    // ...or probe `other` for the members of `set`, marking the shared ones by slot,
+    // then place every member of `set` and a copy of every unmarked member of `other` into a new table
+    size_t bucket_count = other->map.bucket_count;
+    uint8_t* shared = calloc((bucket_count + other->map.old.bucket_count + 7) / 8, 1);
+    hh_map_t table = HH__set_table(set);
+    if(shared == NULL || !HH__map_resize(&table, HH__map_capacity_for(&table, set->map.count + other->map.count))) {
+        free(shared);
+        return 0;
+    }
+    HH__map_table found;
+    hh_set_it(set, it) {
+        char* entry_begin = (char*) HH__map_it_entry(&it);
+        hash = alike ? 
+            HH__MAP_ENTRY_HASH(entry_begin) : 
+            HH__map_hash_generic(&other->map, it.key, it.size_key);
+        size_t idx = HH__map_locate(&other->map, hash, it.key, it.size_key, &found, NULL);
+        if(idx != SIZE_MAX) {
+            if(found.ctrl != other->map.ctrl) idx += bucket_count;
+            shared[idx / 8] |= (uint8_t) (1 << (idx % 8));
+        }
+        HH__map_place(&table, entry_begin);
+        ++(table.count);
+    }
+    hh_set_it(other, it) {
+        size_t idx = it.old ? it.idx + bucket_count : it.idx;
+        if(shared[idx / 8] & (1 << (idx % 8))) continue;
+        hash = alike ? 
+            HH__MAP_ENTRY_HASH(HH__map_it_entry(&it)) : 
+            HH__map_hash_generic(&set->map, it.key, it.size_key);
+        char* entry_begin = HH__map_entry_alloc(&table, hash, it.key, it.size_key, 0);
+        if(entry_begin == NULL) {
+            // copies made so far stay in the arena until hh_set_free
+            free(table.ctrl);
+            free(table.slots);
+            free(shared);
+            return 0;
+        }
+        HH__map_place(&table, entry_begin);
+        ++(table.count);
+    }
+    free(shared);
+    HH__set_replace(set, &table);
+    return 1;
+}
+
+_Bool
+hh_set_intersect(hh_set_t* set, const hh_set_t* other) {
+    if(set == NULL || other == NULL) return 0;
+    if(set == other) return 1;
+    _Bool alike = HH__map_hash_alike(&set->map, &other->map);
+    size_t hash;
+    // either drop the members of `set` that `other` lacks...
+    if(set->map.count <= other->map.count) {
+        hh_set_it(set, it) {
+            hash = alike ? 
+                HH__MAP_ENTRY_HASH(HH__map_it_entry(&it)) : 
+                HH__map_hash_generic(&other->map, it.key, it.size_key);
+            if(other->map.ctrl != NULL && HH__map_get(&other->map, hash, it.key, it.size_key).key != NULL) continue;
+            hh_map_it_remove(&it);
         }
-        hh_darrfree(map->buckets[i]);
+        return 1;
+    }
+    // ...or place the members of `set` that `other` holds into a new table, without copying them
+    hh_map_t table = HH__set_table(set);
+    if(!HH__map_resize(&table, HH__map_capacity_for(&table, other->map.count))) return 0;
+    HH__map_table found;
+    hh_set_it(other, it) {
+        hash = alike ? 
+            HH__MAP_ENTRY_HASH(HH__map_it_entry(&it)) : 
+            HH__map_hash_generic(&set->map, it.key, it.size_key);
+        size_t idx = HH__map_locate(&set->map, hash, it.key, it.size_key, &found, NULL);
+        if(idx == SIZE_MAX) continue;
+        HH__map_place(&table, found.slots[idx]);
+        ++(table.count);
+    }
+    HH__set_replace(set, &table);
+    return 1;
+}
+
+void
+hh_set_free(hh_set_t* set) {
+    hh_map_free(&set->map);
+    if(set->keys == NULL) return;
+    hh_arena_free(set->keys);
+    free(set->keys);
+    set->keys = NULL;
+    set->map.storage = NULL;
+}
+
+void
+hh_map_frozen_free(hh_map_frozen_t* frozen) {
+    if(frozen->mapping != NULL) {
+        HH__map_unmap(frozen->mapping, frozen->size_mapping);
+    } else {
+        free(frozen->disp);
+        free(frozen->offsets32);
+        free(frozen->offsets);
+        free(frozen->data);
     }
-    free(map->buckets);
+    frozen->count = 0;
+    frozen->bucket_count = 0;
+    frozen->size_data = 0;
+    frozen->disp = NULL;
+    frozen->offsets32 = NULL;
+    frozen->offsets = NULL;
+    frozen->data = NULL;
+    frozen->mapping = NULL;
+    frozen->size_mapping = 0;
 }
 
 static const char*
@@ -1893,7 +4490,7 @@ hh_args_print_usage(const hh_args_t* args, FILE* stream, int argc, char* argv[])
     fprintf(stream, "SYNOPSIS\n");
     HH__args_print_synopsis(args->data->deepest_parsed, stream, argc, argv);
     fputc('\n', stream);
-    _Bool* levels = NULL;
+    HH_DARR_INLINE(_Bool, levels, 16);
     size_t padding = HH__args_print_usage_inner(args, stream, argc, argv, 
         &levels, 1, 0);
     hh_darrclear(levels);
@@ -1921,7 +4518,7 @@ hh_read_entire_file(const char* path) {
     }
     unsigned long size = (unsigned long) size_temp;
     rewind(f);
-    (void) hh_darradd(f_buf, size);
+    (void) hh_darraddn_uninit(f_buf, size);
     if(f_buf == NULL) {
         HH_ERR("Failed to allocate buffer for file contents [%s].", path);
         goto failure;
@@ -1931,7 +4528,9 @@ hh_read_entire_file(const char* path) {
         HH_ERR("Failed to read entire file into buffer [%s].", path);
         goto failure;
     }
-    (void) hh_darradd(f_buf, '\0');
+    // null-terminate without counting the terminator in the length
+    hh_darrput(f_buf, '\0');
+    (void) hh_darrpop(f_buf);
     fclose(f);
     return f_buf;
 failure:
@@ -2069,10 +4668,35 @@ hh_getline(char** buf, size_t* bufsiz, FILE* fp) {
 #define darrcap hh_darrcap
 #define darrswap hh_darrswap
 #define darrswapdel hh_darrswapdel
+#define darrinsert hh_darrinsert
+#define darrdel hh_darrdel
+#define darrdelrange hh_darrdelrange
+#define DARR_DEFINE HH_DARR_DEFINE
+#define darropen hh_darropen
+#define darrsync hh_darrsync
+#define DARR_INLINE HH_DARR_INLINE
+#define segarrclear hh_segarrclear
+#define segarrfree hh_segarrfree
+#define segarrat hh_segarrat
+#define segarrlast hh_segarrlast
+#define segarrput hh_segarrput
+#define segarrpop hh_segarrpop
+#define segarradd hh_segarradd
+#define segarrlen hh_segarrlen
+#define segarrcap hh_segarrcap
 #define darrputstr hh_darrputstr
+#define darraddn_uninit hh_darraddn_uninit
+#define darrputn hh_darrputn
+#define darrreserve hh_darrreserve
+#define darrshrink hh_darrshrink
 #define arena hh_arena
 #define arena_alloc hh_arena_alloc
+#define arena_alloc_aligned hh_arena_alloc_aligned
 #define arena_free hh_arena_free
+#define arena_mark_t hh_arena_mark_t
+#define arena_mark hh_arena_mark
+#define arena_rewind hh_arena_rewind
+#define arena_reset hh_arena_reset
 #define path_alloc hh_path_alloc
 #define path_exists hh_path_exists
 #define path_is_file hh_path_is_file
@@ -2101,6 +4725,8 @@ hh_getline(char** buf, size_t* bufsiz, FILE* fp) {
 #define span_next_lf hh_span_next_lf
 #define span_next_ld hh_span_next_ld
 #define span_next_zu hh_span_next_zu
+#define hash_bytes hh_hash_bytes
+#define hash_seed_random hh_hash_seed_random
 #define map_hash_f hh_map_hash_f
 #define map_comp_f hh_map_comp_f
 #define map_free_f hh_map_free_f
@@ -2109,12 +4735,51 @@ hh_getline(char** buf, size_t* bufsiz, FILE* fp) {
 #define map_insert hh_map_insert
 #define map_insert_with_cstr_key hh_map_insert_with_cstr_key
 #define map_insert_entry hh_map_insert_entry
+#define map_upsert hh_map_upsert
+#define map_get_or_insert hh_map_get_or_insert
 #define map_get hh_map_get
 #define map_get_with_cstr_key hh_map_get_with_cstr_key
 #define map_get_val hh_map_get_val
+#define map_get_many hh_map_get_many
 #define map_remove hh_map_remove
+#define map_reserve hh_map_reserve
+#define map_build hh_map_build
+#define map_it_t hh_map_it_t
 #define map_it hh_map_it
+#define map_it_remove hh_map_it_remove
 #define map_free hh_map_free
+#define map_concurrent_t hh_map_concurrent_t
+#define map_concurrent_init hh_map_concurrent_init
+#define map_concurrent_insert hh_map_concurrent_insert
+#define map_concurrent_get hh_map_concurrent_get
+#define map_concurrent_remove hh_map_concurrent_remove
+#define map_concurrent_count hh_map_concurrent_count
+#define map_concurrent_free hh_map_concurrent_free
+#define map_frozen_t hh_map_frozen_t
+#define map_freeze hh_map_freeze
+#define map_frozen_get hh_map_frozen_get
+#define map_frozen_get_with_cstr_key hh_map_frozen_get_with_cstr_key
+#define map_frozen_get_val hh_map_frozen_get_val
+#define map_frozen_get_val_with_cstr_key hh_map_frozen_get_val_with_cstr_key
+#define map_save hh_map_save
+#define map_frozen_save hh_map_frozen_save
+#define map_open_mapped hh_map_open_mapped
+#define map_frozen_free hh_map_frozen_free
+#define MAP_DEFINE HH_MAP_DEFINE
+#define set_t hh_set_t
+#define set_add hh_set_add
+#define set_has hh_set_has
+#define set_del hh_set_del
+#define set_add_cstr hh_set_add_cstr
+#define set_has_cstr hh_set_has_cstr
+#define set_del_cstr hh_set_del_cstr
+#define set_it hh_set_it
+#define set_union hh_set_union
+#define set_intersect hh_set_intersect
+#define set_free hh_set_free
+#define MAP_DEFINE_WITH HH_MAP_DEFINE_WITH
+#define MAP_HASH_BYTES HH_MAP_HASH_BYTES
+#define MAP_EQ_BYTES HH_MAP_EQ_BYTES
 #define args_t hh_args_t
 #define flag_type hh_flag_type
 #define flag_opt hh_flag_opt
@@ -0,0 +1,90 @@
+// hh_arena_reset and hh_arena_rewind keep at most this many unused pages
+#define HH_ARENA_RETAIN_MAX 4
+
+#define HH_IMPLEMENTATION
+#define HH_STRIP_PREFIXES
+#include "h.h"
+
+#define PAGE_COUNT 64
+
+static size_t
+page_count(arena* storage) {
+    size_t pages = (storage->ptr != NULL);
+    for(arena* page = storage->next; page != NULL; page = page->next) ++pages;
+    return pages;
+}
+
+int
+main(void) {
+    arena storage = {0};
+    // default alignment holds across pages
+    size_t total = 0;
+    while(total < PAGE_COUNT * HH_ARENA_DEFAULT_SIZE) {
+        size_t sz = total % 23 + 1;
+        char* ptr = arena_alloc(&storage, sz);
+        ASSERT(ptr != NULL && (uintptr_t) ptr % HH_ARENA_ALIGN == 0, "hh_arena_alloc returned a misaligned pointer: sz = %zu", sz);
+        memset(ptr, 0xAB, sz);
+        total += sz;
+    }
+    // the tail is the last page in the chain
+    size_t pages = 1;
+    arena* page = &storage;
+    for(; page->next != NULL; page = page->next) ++pages;
+    ASSERT(pages >= PAGE_COUNT && storage.tail == page, "hh_arena lost track of its last page: pages = %zu", pages);
+    // explicit alignment, including alignments stricter than malloc's
+    size_t aligns[] = { 1, 2, 8, 64, 4096 };
+    for(size_t i = 0; i < sizeof(aligns) / sizeof(*aligns); ++i) {
+        char* ptr = arena_alloc_aligned(&storage, 3, aligns[i]);
+        ASSERT(ptr != NULL && (uintptr_t) ptr % aligns[i] == 0, "hh_arena_alloc_aligned returned a misaligned pointer: align = %zu", aligns[i]);
+    }
+    // allocations larger than a page get a page of their own
+    char* big = arena_alloc_aligned(&storage, HH_ARENA_DEFAULT_SIZE * 2, 256);
+    ASSERT(big != NULL && (uintptr_t) big % 256 == 0, "hh_arena_alloc_aligned failed on an oversized allocation");
+    memset(big, 0, HH_ARENA_DEFAULT_SIZE * 2);
+    // allocations keep working after a big page
+    char* small = arena_alloc(&storage, 16);
+    ASSERT(small != NULL && (small < big || small >= big + HH_ARENA_DEFAULT_SIZE * 2), "hh_arena_alloc overlapped a previous allocation");
+    // rewinding releases everything allocated since the mark
+    arena_mark_t outer = arena_mark(&storage);
+    char* first = arena_alloc(&storage, 32);
+    arena_mark_t inner = arena_mark(&storage);
+    for(size_t i = 0; i < 3 * HH_ARENA_DEFAULT_SIZE / 64; ++i) ASSERT(arena_alloc(&storage, 64) != NULL, "hh_arena_alloc failed");
+    arena_rewind(&storage, inner);
+    ASSERT(arena_alloc(&storage, 32) == first + 32 + (HH_ARENA_ALIGN - 32 % HH_ARENA_ALIGN) % HH_ARENA_ALIGN, 
+        "hh_arena_rewind didn't restore the inner mark");
+    arena_rewind(&storage, outer);
+    ASSERT(arena_alloc(&storage, 32) == first, "hh_arena_rewind didn't restore the outer mark");
+    // resetting keeps up to HH_ARENA_RETAIN_MAX unused pages, so replaying a workload allocates nothing
+    arena_reset(&storage);
+    ASSERT(page_count(&storage) == 1 + HH_ARENA_RETAIN_MAX, "hh_arena_reset retained the wrong number of pages: pages = %zu", page_count(&storage));
+    char* head = arena_alloc(&storage, 1);
+    ASSERT(head == storage.ptr, "hh_arena_reset didn't rewind to the first page");
+    for(size_t i = 0; i < 3 * HH_ARENA_DEFAULT_SIZE / 64; ++i) ASSERT(arena_alloc(&storage, 64) != NULL, "hh_arena_alloc failed");
+    ASSERT(page_count(&storage) == 1 + HH_ARENA_RETAIN_MAX, "hh_arena_alloc didn't reuse retained pages: pages = %zu", page_count(&storage));
+    arena_free(&storage);
+    ASSERT(storage.ptr == NULL && storage.next == NULL && storage.tail == NULL, "hh_arena_free didn't reset the arena");
+    // arena is reusable after being freed
+    ASSERT(arena_alloc(&storage, 1) != NULL, "hh_arena_alloc failed after hh_arena_free");
+    arena_free(&storage);
+    // marks taken before the first allocation rewind to the start of the first page
+    arena_mark_t empty = arena_mark(&storage);
+    first = arena_alloc(&storage, 8);
+    arena_rewind(&storage, empty);
+    ASSERT(arena_alloc(&storage, 8) == first, "hh_arena_rewind failed on a mark taken from an empty arena");
+    arena_reset(&storage);
+    arena_free(&storage);
+    // arenas and their marks survive being copied by value
+    arena original = {0};
+    first = arena_alloc(&original, 16);
+    arena_mark_t copied = arena_mark(&original);
+    arena moved = original;
+    memset(&original, 0, sizeof(original));
+    char* second = arena_alloc(&moved, 16);
+    ASSERT(second == first + HH_MAX(16, HH_ARENA_ALIGN) && original.ptr == NULL, "hh_arena_alloc used the arena it was copied from");
+    arena_rewind(&moved, copied);
+    ASSERT(arena_alloc(&moved, 16) == second, "hh_arena_rewind failed on an arena copied after the mark");
+    arena_reset(&moved);
+    ASSERT(arena_alloc(&moved, 16) == first && moved.tail == NULL, "hh_arena_reset failed on a copied arena");
+    arena_free(&moved);
+    return 0;
+}
@@ -1,9 +1,41 @@
+#include <stddef.h>
+
+// counts live arrays through the allocator hooks
+static void*
+test_realloc(void* ptr, size_t size);
+static void
+test_free(void* ptr);
+
+#define HH_DARR_REALLOC(ptr, size) test_realloc((ptr), (size))
+#define HH_DARR_FREE(ptr) test_free(ptr)
+// 1.5x growth
+#define HH_DARR_GROW(cap, min_cap, elem_size) HH_MAX((cap) + (cap) / 2, HH_MAX((min_cap), 4))
+
 #define HH_IMPLEMENTATION
 #define HH_STRIP_PREFIXES
 #include "h.h"
 
 #include <stdint.h>
 
+HH_DARR_DEFINE(f64arr, double)
+
+struct pose { double xyz[3], q[3]; };
+DARR_DEFINE(posearr, struct pose)
+
+static size_t live;
+
+static void*
+test_realloc(void* ptr, size_t size) {
+    if(ptr == NULL) ++live;
+    return realloc(ptr, size);
+}
+
+static void
+test_free(void* ptr) {
+    if(ptr != NULL) --live;
+    free(ptr);
+}
+
 int
 main(void) {
     char** arr = NULL, fst[6], snd[6];
@@ -58,5 +90,170 @@ main(void) {
     ASSERT(darrlen(arr) == 0, 
         "hh_darrswapdel failed to remove all elements");
     darrfree(arr);
+    // bulk appends
+    int* nums = NULL, src[100];
+    for(i = 0; i < 100; ++i) src[i] = (int) i;
+    ASSERT(darrreserve(nums, 1000) >= 1000 && darrlen(nums) == 0, 
+        "hh_darrreserve failed: len = %zu, cap = %zu", darrlen(nums), darrcap(nums));
+    for(i = 0; i < 10; ++i) ASSERT(darrputn(nums, src, 100) == i * 100, "hh_darrputn returned incorrect index");
+    ASSERT(darrcap(nums) >= 1000 && darrcap(nums) < 2000, "hh_darrputn grew a reserved array: cap = %zu", darrcap(nums));
+    for(i = 0; i < darrlen(nums); ++i) ASSERT(nums[i] == (int) (i % 100), "hh_darrputn copied incorrectly: idx = %zu", i);
+    // appending an array to itself, which has to grow first
+    j = darrlen(nums);
+    for(k = j; k < darrcap(nums); ++k) darrput(nums, (int) (k % 100));
+    ASSERT(darrputn(nums, nums + 50, k - 50) == k && darrlen(nums) == 2 * k - 50, "hh_darrputn failed to append from itself");
+    for(i = k; i < darrlen(nums); ++i) ASSERT(nums[i] == (int) ((i - k + 50) % 100), "hh_darrputn copied incorrectly from itself: idx = %zu", i);
+    hh_darrheader(nums)->len = j;
+    j = darraddn_uninit(nums, 50);
+    ASSERT(j == 1000 && darrlen(nums) == 1050, "hh_darraddn_uninit failed: len = %zu", darrlen(nums));
+    ASSERT(darrshrink(nums) == 1050 && darrcap(nums) == darrlen(nums), "hh_darrshrink failed: cap = %zu", darrcap(nums));
+    darrclear(nums);
+    ASSERT(darrshrink(nums) == 0, "hh_darrshrink failed to release an empty array");
+    darrput(nums, 7);
+    ASSERT(darrlen(nums) == 1 && nums[0] == 7, "hh_darrput failed after hh_darrshrink");
+    darrfree(nums);
+    // string appends
+    char* str = NULL;
+    ASSERT(darrputstr(str, "Hello") == 0, "hh_darrputstr returned incorrect index");
+    ASSERT(darrputstr(str, ", ") == 5 && darrputstr(str, "World") == 7, "hh_darrputstr returned incorrect index");
+    ASSERT(strcmp(str, "Hello, World") == 0 && darrlen(str) == 13, 
+        "hh_darrputstr failed: str = \"%s\", len = %zu", str, darrlen(str));
+    (void) darrpop(str);
+    darrputstr(str, "!");
+    ASSERT(strcmp(str, "Hello, World!") == 0 && darrlen(str) == 14, 
+        "hh_darrputstr failed to append after an unterminated string: str = \"%s\"", str);
+    darrfree(str);
+    // ordered insertion and deletion
+    for(i = 0; i < 10; ++i) darrinsert(nums, 0, (int) i);
+    darrinsert(nums, darrlen(nums), 100);
+    darrinsert(nums, 5, -1);
+    static const int inserted[] = { 9, 8, 7, 6, 5, -1, 4, 3, 2, 1, 0, 100 };
+    ASSERT(darrlen(nums) == 12 && memcmp(nums, inserted, sizeof(inserted)) == 0, "hh_darrinsert failed");
+    // insertion grows exactly when appending would
+    size_t cap = darrcap(nums);
+    while(darrlen(nums) < cap - 1) darrput(nums, 0);
+    darrinsert(nums, 0, 9);
+    ASSERT(darrcap(nums) == cap, "hh_darrinsert grew an array with room for the element");
+    darrinsert(nums, 0, 9);
+    ASSERT(darrcap(nums) == HH_DARR_GROW(cap, cap + 1, sizeof(int)), "hh_darrinsert bypassed HH_DARR_GROW");
+    darrdelrange(nums, 0, 2);
+    darrdelrange(nums, 12, darrlen(nums) - 12);
+    darrdel(nums, 5);
+    darrdel(nums, darrlen(nums) - 1);
+    darrdelrange(nums, 2, 3);
+    darrdelrange(nums, 0, 0);
+    static const int deleted[] = { 9, 8, 4, 3, 2, 1, 0 };
+    ASSERT(darrlen(nums) == 7 && memcmp(nums, deleted, sizeof(deleted)) == 0, "hh_darrdel failed");
+    darrdelrange(nums, 0, darrlen(nums));
+    ASSERT(darrlen(nums) == 0, "hh_darrdelrange failed to delete every element");
+    darrfree(nums);
+    // swaps of every element size the fast paths handle, and a few they don't
+    static const size_t sizes[] = { 1, 2, 3, 4, 8, 12, 16, 32, 40, 100 };
+    for(i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i) {
+        // two elements of sizes[i] bytes, viewed through a byte array
+        unsigned char* bytes = NULL;
+        (void) darradd(bytes, 2 * sizes[i]);
+        for(k = 0; k < sizes[i]; ++k) {
+            bytes[k] = (unsigned char) k;
+            bytes[sizes[i] + k] = (unsigned char) (255 - k);
+        }
+        hh_darrheader(bytes)->elem_size = sizes[i];
+        hh_darrheader(bytes)->len = 2;
+        darrswap(bytes, 0, 1);
+        for(k = 0; k < sizes[i]; ++k) 
+            ASSERT(bytes[k] == (unsigned char) (255 - k) && bytes[sizes[i] + k] == (unsigned char) k, 
+                "hh_darrswap failed: elem_size = %zu, byte = %zu", sizes[i], k);
+        darrfree(bytes);
+    }
+    // insertion of elements larger than its stack buffer
+    struct { unsigned char b[100]; } * wide = NULL, elem;
+    for(i = 0; i < 5; ++i) {
+        memset(elem.b, (int) i, sizeof(elem.b));
+        darrinsert(wide, i / 2, elem);
+    }
+    static const unsigned char order[] = { 1, 3, 4, 2, 0 };
+    for(i = 0; i < 5; ++i) for(k = 0; k < sizeof(elem.b); ++k)
+        ASSERT(wide[i].b[k] == order[i], "hh_darrinsert failed on wide elements: idx = %zu, byte = %zu", i, k);
+    darrfree(wide);
+    // typed arrays
+    f64arr_t f64s = NULL;
+    ASSERT(f64arr_reserve(&f64s, 100) >= 100 && darrlen(f64s) == 0, "f64arr_reserve failed");
+    for(i = 0; i < 1000; ++i) f64arr_push(&f64s, (double) i);
+    f64arr_insert(&f64s, 0, -1.0);
+    f64arr_insert(&f64s, darrlen(f64s), 1000.0);
+    ASSERT(darrlen(f64s) == 1002 && *f64arr_at(f64s, 0) == -1.0 && *f64arr_at(f64s, 500) == 499.0, "f64arr_insert failed");
+    ASSERT(f64arr_pop(f64s) == 1000.0 && f64arr_pop(f64s) == 999.0, "f64arr_pop failed");
+    // generic macros accept typed arrays
+    darrput(f64s, 2.5);
+    ASSERT(darrlen(f64s) == 1001 && darrlast(f64s) == 2.5, "hh_darrput failed on a typed array");
+    darrfree(f64s);
+    posearr_t poses = NULL;
+    for(i = 0; i < 100; ++i) posearr_push(&poses, (struct pose) { .xyz = { (double) i } });
+    ASSERT(sizeof(struct pose) == 48 && hh_darrheader(poses)->elem_size == 48, "posearr stored incorrect element size");
+    darrswap(poses, 0, 99);
+    ASSERT(posearr_at(poses, 0)->xyz[0] == 99.0 && posearr_pop(poses).xyz[0] == 0.0, "hh_darrswap failed on a typed array");
+    darrfree(poses);
+    // segmented arrays
+    struct pose** segs = NULL;
+    for(i = 0; i < 10000; ++i) segarrput(segs, ((struct pose) { .xyz = { (double) i } }));
+    struct pose* first = &segarrat(segs, 0), * mid = &segarrat(segs, 5000);
+    ASSERT(segarrlen(segs) == 10000 && segarrcap(segs) >= 10000, "hh_segarrput failed: len = %zu", segarrlen(segs));
+    j = segarradd(segs, 100000);
+    ASSERT(j == 10000 && segarrlen(segs) == 110000, "hh_segarradd returned incorrect index");
+    ASSERT(first == &segarrat(segs, 0) && mid == &segarrat(segs, 5000) && mid->xyz[0] == 5000.0, 
+        "hh_segarr moved elements while growing");
+    for(i = 0; i < segarrlen(segs); ++i) {
+        ASSERT(segarrat(segs, i).xyz[0] == (double) (i < 10000 ? i : 0) && segarrat(segs, i).q[2] == 0.0, 
+            "hh_segarr returned incorrect element: idx = %zu", i);
+        // consecutive indices are adjacent within a segment
+        if(i > 0 && HH__segarr_off(i) > 0) ASSERT(&segarrat(segs, i) == &segarrat(segs, i - 1) + 1, 
+            "hh_segarrat computed an incorrect address: idx = %zu", i);
+    }
+    segarrlast(segs).xyz[1] = 1.0;
+    ASSERT(segarrpop(segs).xyz[1] == 1.0 && segarrlen(segs) == 109999, "hh_segarrpop failed");
+    segarrclear(segs);
+    ASSERT(segarrlen(segs) == 0 && segarrcap(segs) >= 110000, "hh_segarrclear failed");
+    segarrfree(segs);
+    ASSERT(segs == NULL && segarrlen(segs) == 0, "hh_segarrfree failed");
+    // file-backed arrays
+    const char* path = PROJECT_ROOT "tests/assets/test_darr_open.bin";
+    remove(path);
+    uint64_t* mapped = NULL;
+    ASSERT(darropen(mapped, path) && darrlen(mapped) == 0, "hh_darropen failed to create: path = %s", path);
+    for(i = 0; i < 100000; ++i) darrput(mapped, (uint64_t) i * 3);
+    uint64_t tail[10] = {0};
+    ASSERT(darrputn(mapped, tail, 10) == 100000 && darrsync(mapped), "hh_darrsync failed");
+    darrfree(mapped);
+    ASSERT(darropen(mapped, path) && darrlen(mapped) == 100010 && darrcap(mapped) == 100010, 
+        "hh_darropen failed to reopen: len = %zu", darrlen(mapped));
+    for(i = 0; i < 100000; ++i) ASSERT(mapped[i] == (uint64_t) i * 3, "hh_darropen restored incorrect element: idx = %zu", i);
+    darrswapdel(mapped, 0);
+    darrdelrange(mapped, 0, 99990);
+    ASSERT(darrshrink(mapped) == 19 && darrlen(mapped) == 19, "hh_darrshrink failed on a file-backed array");
+    darrfree(mapped);
+    // reopening requires the same element size
+    uint32_t* narrow = NULL;
+    ASSERT(!darropen(narrow, path) && narrow == NULL, "hh_darropen accepted a different element size");
+    FILE* fp = fopen(path, "wb");
+    ASSERT(fp != NULL && fwrite("HDAR", 1, 4, fp) == 4 && fclose(fp) == 0, "Failed to write %s", path);
+    ASSERT(!darropen(mapped, path), "hh_darropen accepted a truncated file");
+    remove(path);
+    // inline arrays
+    size_t allocated = live;
+    DARR_INLINE(int, small, 8);
+    for(i = 0; i < 6; ++i) darrput(small, (int) i);
+    darrinsert(small, 0, -1);
+    darrdel(small, 0);
+    for(; i < 8; ++i) darrput(small, (int) i);
+    ASSERT(live == allocated && darrlen(small) == 8 && darrcap(small) == 8 && darrshrink(small) == 8, 
+        "HH_DARR_INLINE allocated before it overflowed");
+    ASSERT(darrputn(small, src, 100) == 8 && live == allocated + 1, "HH_DARR_INLINE failed to spill to the heap");
+    for(i = 0; i < darrlen(small); ++i) ASSERT(small[i] == (int) (i < 8 ? i : i - 8), "HH_DARR_INLINE lost an element: idx = %zu", i);
+    darrfree(small);
+    DARR_INLINE(char, cmd, 16);
+    darrputstr(cmd, "Hello");
+    darrfree(cmd);
+    ASSERT(live == allocated && cmd == NULL, "hh_darrfree failed on an inline array");
+    ASSERT(live == 0, "HH_DARR_FREE was not called for %zu arrays", live);
     return 0;
 }
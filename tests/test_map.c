@@ -0,0 +1,700 @@
+#define HH_IMPLEMENTATION
+#define HH_STRIP_PREFIXES
+#define HH_MAP_THREADS
+#include "h.h"
+
+#include <stdbool.h>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define KEY_COUNT 10000
+
+HH_MAP_DEFINE(u64map, uint64_t, double)
+
+// a padded key needs its own hash and eq
+typedef struct { uint8_t tag; uint64_t id; } padded_key;
+#define PADDED_HASH(key) ((size_t) ((key)->id * 0x9E3779B97F4A7C15ull) ^ (key)->tag)
+#define PADDED_EQ(key_a, key_b) ((key_a)->tag == (key_b)->tag && (key_a)->id == (key_b)->id)
+HH_MAP_DEFINE_WITH(padded_map, padded_key, int, PADDED_HASH, PADDED_EQ)
+
+static void
+test_map_basic(bool incremental) {
+    DBG("Testing hh_map_t: incremental = %s", STRINGIFY_BOOL(incremental));
+    // start deliberately small so the table has to grow
+    map_t map = { .bucket_count = 4, .incremental = incremental };
+    char key[32];
+    size_t val;
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        ASSERT(map_insert(&map, key, strlen(key), &i, sizeof(i)), "hh_map_insert failed: key = %s", key);
+    }
+    DBG("Inserted %d keys: bucket_count = %zu", KEY_COUNT, map.bucket_count);
+    ASSERT(map.count == KEY_COUNT, "hh_map_t count is incorrect: count = %zu", map.count);
+    ASSERT((double) map.count <= (double) map.bucket_count * HH_MAP_MAX_LOAD, 
+        "hh_map_t exceeded its load factor: count = %zu, bucket_count = %zu", map.count, map.bucket_count);
+    // every key should be retrievable
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        map_entry_t entry = map_get(&map, key, strlen(key));
+        ASSERT(entry.val != NULL, "hh_map_get failed to find key: key = %s", key);
+        ASSERT(entry.size_key == strlen(key) && entry.size_val == sizeof(size_t), 
+            "hh_map_get returned incorrect sizes: key = %s", key);
+        memcpy(&val, entry.val, sizeof(val));
+        ASSERT(val == i, "hh_map_get returned incorrect value: key = %s, val = %zu", key, val);
+    }
+    ASSERT(map_get_val(&map, "missing", 7) == NULL, "hh_map_get_val found a key that was never inserted");
+    // overwrite the odd keys
+    for(size_t i = 1; i < KEY_COUNT; i += 2) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        val = i * 2;
+        ASSERT(map_insert(&map, key, strlen(key), &val, sizeof(val)), "hh_map_insert failed to overwrite: key = %s", key);
+    }
+    // remove the even keys
+    for(size_t i = 0; i < KEY_COUNT; i += 2) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        ASSERT(map_remove(&map, key, strlen(key)), "hh_map_remove failed: key = %s", key);
+        ASSERT(!map_remove(&map, key, strlen(key)), "hh_map_remove removed a key twice: key = %s", key);
+    }
+    ASSERT(map.count == KEY_COUNT / 2, "hh_map_remove did not update count: count = %zu", map.count);
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        const void* ptr = map_get_val(&map, key, strlen(key));
+        if(i % 2 == 0) {
+            ASSERT(ptr == NULL, "hh_map_get_val found a removed key: key = %s", key);
+        } else {
+            ASSERT(ptr != NULL, "hh_map_get_val lost a key after removals: key = %s", key);
+            memcpy(&val, ptr, sizeof(val));
+            ASSERT(val == i * 2, "hh_map_insert failed to overwrite value: key = %s", key);
+        }
+    }
+    // iteration visits every remaining entry exactly once
+    size_t count = 0, sum = 0;
+    map_it(&map, it) {
+        memcpy(&val, it.val, sizeof(val));
+        sum += val;
+        ++count;
+    }
+    ASSERT(count == KEY_COUNT / 2, "hh_map_it visited %zu entries, expected %d", count, KEY_COUNT / 2);
+    ASSERT(sum == (size_t) KEY_COUNT * KEY_COUNT / 2, "hh_map_it visited the wrong entries");
+    DBG("Iterated %zu entries after removals", count);
+    map_free(&map);
+    ASSERT(map_get_val(&map, "key_1", 5) == NULL, "hh_map_get_val found a key after hh_map_free");
+}
+
+static void
+test_map_reserve(void) {
+    // reserving up front means bulk insertion never rehashes
+    map_t reserved = { .bucket_count = 8, .max_load = 0.5 };
+    ASSERT(map_reserve(&reserved, KEY_COUNT), "hh_map_reserve failed");
+    size_t bucket_count = reserved.bucket_count;
+    for(size_t i = 0; i < KEY_COUNT; ++i) map_insert(&reserved, &i, sizeof(i), NULL, 0);
+    ASSERT(reserved.bucket_count == bucket_count, 
+        "hh_map_insert rehashed after hh_map_reserve: bucket_count = %zu, expected = %zu", reserved.bucket_count, bucket_count);
+    // churn through removals and insertions, tombstones must not grow the table
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        map_remove(&reserved, &i, sizeof(i));
+        size_t j = i + KEY_COUNT;
+        map_insert(&reserved, &j, sizeof(j), NULL, 0);
+    }
+    ASSERT(reserved.count == KEY_COUNT, "hh_map_t count drifted during churn: count = %zu", reserved.count);
+    ASSERT(reserved.bucket_count == bucket_count, 
+        "hh_map_t grew while its size was constant: bucket_count = %zu, expected = %zu", reserved.bucket_count, bucket_count);
+    // sizes beyond any table fail instead of overflowing
+    ASSERT(!map_reserve(&reserved, SIZE_MAX) && !map_reserve(&reserved, SIZE_MAX / 2 + 2), "hh_map_reserve accepted an impossible size");
+    ASSERT(reserved.bucket_count == bucket_count && reserved.count == KEY_COUNT, "hh_map_reserve changed the map after failing");
+    map_free(&reserved);
+    map_t hinted = { .bucket_count = SIZE_MAX };
+    size_t key = 0;
+    ASSERT(!map_reserve(&hinted, 1) && !map_insert(&hinted, &key, sizeof(key), NULL, 0), "hh_map_t accepted an impossible bucket_count");
+    u64map_t typed = {0};
+    ASSERT(!u64map_reserve(&typed, SIZE_MAX) && typed.ctrl == NULL, "HH_MAP_DEFINE reserve accepted an impossible size");
+    ASSERT(u64map_insert(&typed, 1, 1.0) && !u64map_reserve(&typed, SIZE_MAX), "HH_MAP_DEFINE reserve accepted an impossible size");
+    ASSERT(*u64map_get(&typed, 1) == 1.0, "HH_MAP_DEFINE reserve changed the map after failing");
+    u64map_free(&typed);
+}
+
+static void
+test_map_migration(void) {
+    map_t map = { .bucket_count = 16, .incremental = true };
+    size_t i = 0, count, sum;
+    // insert until a growth leaves the old table partially migrated
+    do {
+        map_insert(&map, &i, sizeof(i), &i, sizeof(i));
+        ++i;
+    } while(map.old.ctrl == NULL || map.count < 1000);
+    DBG("Paused during migration: count = %zu, old.count = %zu, bucket_count = %zu, old.bucket_count = %zu",
+        map.count, map.old.count, map.bucket_count, map.old.bucket_count);
+    // iteration must see each element exactly once, even though two tables coexist
+    count = sum = 0;
+    map_it(&map, it) {
+        ++count;
+        sum += *((const size_t*) it.key);
+    }
+    ASSERT(count == i, "hh_map_it visited %zu entries during migration, expected %zu", count, i);
+    ASSERT(sum == i * (i - 1) / 2, "hh_map_it visited the wrong entries during migration");
+    // lookups reach entries in both tables without migrating any, so they're safe mid-iteration
+    size_t migrated = map.old.migrated;
+    map_it(&map, it) {
+        ASSERT(map_get(&map, it.key, it.size_key).val == it.val, "hh_map_get failed during iteration");
+    }
+    ASSERT(map.old.migrated == migrated && map.old.ctrl != NULL, "hh_map_get advanced the migration");
+    // removals reach entries in both tables and finish the migration
+    for(size_t j = 0; j < i; j += 2) ASSERT(map_remove(&map, &j, sizeof(j)), "hh_map_remove failed during migration");
+    for(size_t j = 0; j < i; ++j) {
+        ASSERT((map_get_val(&map, &j, sizeof(j)) != NULL) == (j % 2 == 1), 
+            "hh_map_get returned incorrect membership during migration: key = %zu", j);
+    }
+    ASSERT(map.old.ctrl == NULL, "hh_map_t migration did not finish after %zu operations", i * 2);
+    ASSERT(map.count == i / 2, "hh_map_t count is incorrect after migration: count = %zu", map.count);
+    map_free(&map);
+}
+
+static void
+test_hash(void) {
+    char buf[128];
+    for(size_t i = 0; i < ARR_LEN(buf); ++i) buf[i] = (char) (i * 31 + 7);
+    // every length goes through a different read pattern, all of them must be sensitive
+    // to the seed and to the last byte of the key
+    for(size_t len = 0; len <= ARR_LEN(buf); ++len) {
+        uint64_t hash = hash_bytes(buf, len, 0);
+        ASSERT(hash == hash_bytes(buf, len, 0), "hh_hash_bytes is not deterministic: len = %zu", len);
+        ASSERT(hash != hash_bytes(buf, len, 1), "hh_hash_bytes ignored its seed: len = %zu", len);
+        if(len == 0) continue;
+        buf[len - 1] ^= 1;
+        ASSERT(hash != hash_bytes(buf, len, 0), "hh_hash_bytes ignored the last byte: len = %zu", len);
+        buf[len - 1] ^= 1;
+    }
+    ASSERT(hash_seed_random() != hash_seed_random(), "hh_hash_seed_random returned the same seed twice");
+    // a seeded map behaves like any other
+    map_t map = { .seed = hash_seed_random() };
+    for(size_t i = 0; i < KEY_COUNT; ++i) map_insert(&map, &i, sizeof(i), &i, sizeof(i));
+    for(size_t i = 0; i < KEY_COUNT; ++i) 
+        ASSERT(map_get_val(&map, &i, sizeof(i)) != NULL, "seeded hh_map_t lost a key: key = %zu", i);
+    map_free(&map);
+}
+
+// pairs of keys share a full hash, and every call is counted
+static size_t hash_calls;
+static size_t
+test_hash_pairs(const void* key, size_t size_key) {
+    (void) size_key;
+    ++hash_calls;
+    return (*((const size_t*) key) / 2) * 0x9E3779B97F4A7C15ull;
+}
+
+static void
+test_map_stored_hash(bool incremental) {
+    DBG("Testing stored hashes: incremental = %s", STRINGIFY_BOOL(incremental));
+    map_t map = { .bucket_count = 16, .hash = test_hash_pairs, .incremental = incremental };
+    hash_calls = 0;
+    for(size_t i = 0; i < KEY_COUNT; ++i) ASSERT(map_insert(&map, &i, sizeof(i), &i, sizeof(i)), "hh_map_insert failed: key = %zu", i);
+    // growing from 16 slots rehashes many times, but only from the stored hashes
+    ASSERT(hash_calls == KEY_COUNT, "hh_map_t rehashed keys while growing: %zu hash calls, expected %d", hash_calls, KEY_COUNT);
+    ASSERT(map_reserve(&map, KEY_COUNT * 4) && hash_calls == KEY_COUNT, "hh_map_reserve called the hash function");
+    // keys with equal hashes are still told apart by comparison
+    for(size_t i = 0; i < KEY_COUNT; i += 2) ASSERT(map_remove(&map, &i, sizeof(i)), "hh_map_remove failed: key = %zu", i);
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        const size_t* val = map_get_val(&map, &i, sizeof(i));
+        ASSERT((val != NULL) == (i % 2 == 1) && (val == NULL || *val == i), 
+            "hh_map_t confused keys with equal hashes: key = %zu", i);
+    }
+    ASSERT(map.count == KEY_COUNT / 2, "hh_map_t count is incorrect: count = %zu", map.count);
+    map_free(&map);
+}
+
+static void
+test_map_upsert(void) {
+    map_t map = {0};
+    // count occurrences of each residue, a typical aggregation
+    bool inserted;
+    size_t inserted_count = 0;
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        size_t key = i % 100;
+        // values aren't aligned, so the count is copied in and out
+        size_t count;
+        void* val = map_get_or_insert(&map, &key, sizeof(key), sizeof(size_t), &inserted);
+        ASSERT(val != NULL, "hh_map_get_or_insert failed: key = %zu", key);
+        ASSERT(inserted == (i < 100), "hh_map_get_or_insert reported incorrect insertion: key = %zu", key);
+        inserted_count += inserted;
+        memcpy(&count, val, sizeof(count));
+        ++count;
+        memcpy(val, &count, sizeof(count));
+    }
+    ASSERT(inserted_count == 100 && map.count == 100, "hh_map_get_or_insert inserted %zu keys, expected 100", inserted_count);
+    for(size_t key = 0, count = 0; key < 100; ++key) {
+        const void* val = map_get_val(&map, &key, sizeof(key));
+        if(val != NULL) memcpy(&count, val, sizeof(count));
+        ASSERT(val != NULL && count == KEY_COUNT / 100, "hh_map_get_or_insert miscounted: key = %zu", key);
+    }
+    // overwriting with the same size keeps the value in place
+    size_t key = 7, val = 42;
+    void* before = (void*) map_get_val(&map, &key, sizeof(key));
+    void* after = map_upsert(&map, &key, sizeof(key), &val, sizeof(val), &inserted);
+    ASSERT(!inserted && before == after, "hh_map_upsert did not overwrite in place");
+    ASSERT(*((size_t*) after) == 42, "hh_map_upsert did not write the value");
+    // while changing the size resizes the entry
+    char str[] = "resized value";
+    char* resized = map_upsert(&map, &key, sizeof(key), str, sizeof(str), &inserted);
+    map_entry_t entry = map_get(&map, &key, sizeof(key));
+    ASSERT(!inserted && resized == entry.val && entry.size_val == sizeof(str) && strcmp(resized, str) == 0,
+        "hh_map_upsert failed to resize the value");
+    ASSERT(map.count == 100, "hh_map_upsert changed the count when overwriting");
+    map_free(&map);
+    // the new value may come from the one it replaces, whether or not its size changes
+    for(int compact = 0; compact < 2; ++compact) {
+        map_t aliased = { .compact = (bool) compact };
+        char bytes[64];
+        for(size_t i = 0; i < sizeof(bytes); ++i) bytes[i] = (char) i;
+        map_insert(&aliased, "k", 1, bytes, sizeof(bytes));
+        const void* old = map_get_val(&aliased, "k", 1);
+        ASSERT(map_upsert(&aliased, "k", 1, (const char*) old + 1, 48, NULL) != NULL, "hh_map_upsert failed to shrink a value");
+        entry = map_get(&aliased, "k", 1);
+        ASSERT(entry.size_val == 48 && memcmp(entry.val, bytes + 1, 48) == 0, "hh_map_upsert lost an aliased value: compact = %d", compact);
+        ASSERT(map_upsert(&aliased, "k", 1, entry.val, 32, NULL) != NULL, "hh_map_upsert failed to shrink a value");
+        entry = map_get(&aliased, "k", 1);
+        ASSERT(entry.size_val == 32 && memcmp(entry.val, bytes + 1, 32) == 0, "hh_map_upsert lost an aliased value: compact = %d", compact);
+        map_upsert(&aliased, "k", 1, (const char*) entry.val + 8, 16, NULL);
+        map_upsert(&aliased, "k", 1, (const char*) map_get_val(&aliased, "k", 1) + 4, 12, NULL);
+        ASSERT(memcmp(map_get_val(&aliased, "k", 1), bytes + 13, 12) == 0, "hh_map_upsert lost an aliased value: compact = %d", compact);
+        map_free(&aliased);
+    }
+}
+
+static void
+test_map_it_remove(bool incremental) {
+    map_t map = { .incremental = incremental };
+    for(size_t i = 0; i < KEY_COUNT; ++i) map_insert(&map, &i, sizeof(i), &i, sizeof(i));
+    // sweep out every multiple of 3 in a single pass
+    size_t visited = 0;
+    map_it(&map, it) {
+        ++visited;
+        if(*((const size_t*) it.val) % 3 == 0) map_it_remove(&it);
+    }
+    ASSERT(visited == KEY_COUNT, "hh_map_it visited %zu entries while removing, expected %d", visited, KEY_COUNT);
+    ASSERT(map.count == KEY_COUNT - (KEY_COUNT + 2) / 3, "hh_map_it_remove left count = %zu", map.count);
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        ASSERT((map_get_val(&map, &i, sizeof(i)) == NULL) == (i % 3 == 0), 
+            "hh_map_it_remove removed the wrong entries: key = %zu", i);
+    }
+    map_free(&map);
+}
+
+static void
+test_map_get_many(void) {
+    map_t map = {0};
+    for(size_t i = 0; i < KEY_COUNT; i += 2) map_insert(&map, &i, sizeof(i), &i, sizeof(i));
+    // query every key, only the even ones are members
+    size_t keys[KEY_COUNT], sizes[KEY_COUNT];
+    const void* ptrs[KEY_COUNT];
+    static map_entry_t entries[KEY_COUNT];
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        keys[i] = i;
+        sizes[i] = sizeof(size_t);
+        ptrs[i] = &keys[i];
+    }
+    size_t found = map_get_many(&map, ptrs, sizes, KEY_COUNT, entries);
+    ASSERT(found == KEY_COUNT / 2, "hh_map_get_many found %zu keys, expected %d", found, KEY_COUNT / 2);
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        map_entry_t entry = map_get(&map, &i, sizeof(i));
+        ASSERT(entries[i].val == entry.val && entries[i].size_val == entry.size_val, 
+            "hh_map_get_many disagrees with hh_map_get: key = %zu", i);
+    }
+    map_free(&map);
+}
+
+static void
+test_map_compact(void) {
+    map_t map = { .compact = true };
+    // sizes that need 1, 2 and 3 varint bytes
+    static const size_t sizes[] = { 0, 1, 127, 128, 16383, 16384, 100000 };
+    // keys are one byte longer than the largest size
+    char* buf = calloc(100000 + 1, 1);
+    ASSERT(buf != NULL, "Failed to allocate");
+    for(size_t i = 0; i < ARR_LEN(sizes); ++i) {
+        // keys are distinguished by their length
+        ASSERT(map_insert(&map, buf, sizes[i] + 1, buf, sizes[i]), "Compact hh_map_insert failed: size = %zu", sizes[i]);
+    }
+    for(size_t i = 0; i < ARR_LEN(sizes); ++i) {
+        map_entry_t entry = map_get(&map, buf, sizes[i] + 1);
+        ASSERT(entry.val != NULL && entry.size_key == sizes[i] + 1 && entry.size_val == sizes[i], 
+            "Compact hh_map_get returned incorrect sizes: size = %zu", sizes[i]);
+        ASSERT(entry.val == (const char*) entry.key + entry.size_key, "Compact entry is not contiguous");
+    }
+    // overwriting with a value whose size needs a different number of varint bytes
+    for(size_t i = 0; i < ARR_LEN(sizes); ++i) {
+        size_t size_val = sizes[ARR_LEN(sizes) - 1 - i];
+        memset(buf, (int) i, 100000);
+        ASSERT(map_insert(&map, &i, sizeof(i), buf, size_val), "Compact hh_map_insert failed to overwrite");
+        map_entry_t entry = map_get(&map, &i, sizeof(i));
+        ASSERT(entry.size_val == size_val && (size_val == 0 || ((const char*) entry.val)[size_val - 1] == (char) i), 
+            "Compact hh_map_insert overwrote incorrectly: size_val = %zu", size_val);
+    }
+    // frozen tables always use the compact layout, with 32-bit offsets below 4 GiB
+    map_frozen_t frozen;
+    ASSERT(map_freeze(&map, &frozen), "hh_map_freeze failed on a compact map");
+    ASSERT(frozen.offsets32 != NULL && frozen.offsets == NULL, "hh_map_freeze used 64-bit offsets for a small table");
+    for(size_t i = 0; i < ARR_LEN(sizes); ++i) {
+        map_entry_t entry = map_get(&map, &i, sizeof(i)), entry_frozen = map_frozen_get(&frozen, &i, sizeof(i));
+        ASSERT(entry_frozen.size_val == entry.size_val && memcmp(entry.val, entry_frozen.val, entry.size_val) == 0, 
+            "hh_map_freeze changed a compact entry: key = %zu", i);
+    }
+    map_frozen_free(&frozen);
+    free(buf);
+    map_free(&map);
+}
+
+static void
+test_map_storage(bool compact) {
+    DBG("Testing hh_map_t with storage: compact = %s", STRINGIFY_BOOL(compact));
+    arena storage = {0};
+    map_t map = { .compact = compact, .storage = &storage };
+    // values follow the key bytes, so they are read with memcpy
+    const void* vals[KEY_COUNT];
+    size_t val;
+    // odd key sizes, so consecutive entries would be misaligned without padding
+    char key[32];
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        ASSERT(map_insert(&map, key, strlen(key), &i, sizeof(i)), "hh_map_insert failed with storage: key = %s", key);
+    }
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        vals[i] = map_get_val(&map, key, strlen(key));
+        ASSERT(vals[i] != NULL, "hh_map_get failed with storage: key = %s", key);
+        memcpy(&val, vals[i], sizeof(val));
+        ASSERT(val == i, "hh_map_get returned incorrect value with storage: key = %s", key);
+    }
+    // removals, overwrites with a new size, and the rehashing they cause leave old values readable
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        if(i % 2 == 0) {
+            ASSERT(map_remove(&map, key, strlen(key)), "hh_map_remove failed with storage: key = %s", key);
+        } else {
+            size_t val[2] = { i * 2, i * 2 };
+            ASSERT(map_insert(&map, key, strlen(key), val, sizeof(val)), "hh_map_insert failed to overwrite: key = %s", key);
+        }
+    }
+    ASSERT(map_reserve(&map, KEY_COUNT * 4), "hh_map_reserve failed with storage");
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        memcpy(&val, vals[i], sizeof(val));
+        ASSERT(val == i, "Value moved or was overwritten: key = %zu", i);
+    }
+    for(size_t i = 1; i < KEY_COUNT; i += 2) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        map_entry_t entry = map_get(&map, key, strlen(key));
+        if(entry.val != NULL) memcpy(&val, (const size_t*) entry.val + 1, sizeof(val));
+        ASSERT(entry.size_val == sizeof(size_t) * 2 && val == i * 2, 
+            "hh_map_get returned a stale value with storage: key = %s", key);
+    }
+    map_free(&map);
+    // the arena outlives the map
+    memcpy(&val, vals[KEY_COUNT - 1], sizeof(val));
+    ASSERT(val == KEY_COUNT - 1, "hh_map_free released arena storage");
+    arena_free(&storage);
+}
+
+static void
+test_map_build(bool compact) {
+    DBG("Testing hh_map_build: compact = %s", STRINGIFY_BOOL(compact));
+    // every key appears 4 times, the later copies have larger values of alternating sizes
+    size_t n = KEY_COUNT * 4;
+    map_entry_t* entries = calloc(n, sizeof(map_entry_t));
+    size_t* keys = calloc(n, sizeof(size_t));
+    size_t* vals = calloc(n * 2, sizeof(size_t));
+    ASSERT(entries != NULL && keys != NULL && vals != NULL, "Failed to allocate");
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = (i * 7919) % KEY_COUNT;
+        vals[i * 2] = vals[i * 2 + 1] = i;
+        entries[i] = (map_entry_t) { sizeof(size_t), sizeof(size_t) * (1 + i % 2), &keys[i], &vals[i * 2] };
+    }
+    map_t expected = { .compact = compact }, map = { .compact = compact };
+    for(size_t i = 0; i < n; ++i) map_insert_entry(&expected, &entries[i]);
+    ASSERT(map_build(&map, entries, n, 4), "hh_map_build failed");
+    ASSERT(map.count == expected.count, "hh_map_build count is incorrect: %zu, expected %zu", map.count, expected.count);
+    map_it(&expected, it) {
+        map_entry_t entry = map_get(&map, it.key, it.size_key);
+        ASSERT(entry.val != NULL && entry.size_val == it.size_val && memcmp(entry.val, it.val, it.size_val) == 0, 
+            "hh_map_build kept the wrong duplicate: key = %zu", *((const size_t*) it.key));
+    }
+    // a second build into the populated map falls back to sequential insertion
+    size_t key = KEY_COUNT, val = 0;
+    map_entry_t extra = { sizeof(key), sizeof(val), &key, &val };
+    ASSERT(map_build(&map, &extra, 1, 0) && map.count == expected.count + 1, "hh_map_build failed on a populated map");
+    map_free(&expected);
+    map_free(&map);
+    free(entries);
+    free(keys);
+    free(vals);
+}
+
+static void
+test_set(void) {
+    set_t evens = {0}, threes = {0}, seeded = { .map = { .seed = hh_hash_seed_random() } };
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        if(i % 2 == 0) ASSERT(set_add(&evens, &i, sizeof(i)), "hh_set_add failed: key = %zu", i);
+        if(i % 3 == 0) ASSERT(set_add(&threes, &i, sizeof(i)), "hh_set_add failed: key = %zu", i);
+        if(i % 5 == 0) ASSERT(set_add(&seeded, &i, sizeof(i)), "hh_set_add failed: key = %zu", i);
+    }
+    size_t zero = 0;
+    ASSERT(set_add(&evens, &zero, sizeof(zero)) && evens.map.count == KEY_COUNT / 2, "hh_set_add added a member twice");
+    ASSERT(evens.map.compact && evens.keys != NULL && evens.map.storage == evens.keys, "hh_set_t members are not compact or not arena-backed");
+    for(size_t i = 0; i < KEY_COUNT; ++i) 
+        ASSERT(set_has(&evens, &i, sizeof(i)) == (i % 2 == 0), "hh_set_has returned incorrect membership: key = %zu", i);
+    size_t count = 0;
+    set_it(&threes, it) {
+        size_t member; // compact entries leave keys unaligned
+        memcpy(&member, it.key, sizeof(member));
+        ASSERT(it.size_key == sizeof(size_t) && member % 3 == 0, "hh_set_it visited a non-member");
+        ++count;
+    }
+    ASSERT(count == threes.map.count, "hh_set_it visited %zu members, expected %zu", count, threes.map.count);
+    // intersections in both directions, then against a differently seeded set
+    set_t sixes = {0}, copy = {0};
+    ASSERT(set_union(&sixes, &evens) && sixes.map.count == evens.map.count, "hh_set_union into an empty set failed");
+    ASSERT(sixes.map.compact && sixes.keys != NULL, "hh_set_union into an empty set didn't store members compactly");
+    ASSERT(set_intersect(&sixes, &threes), "hh_set_intersect failed");
+    ASSERT(set_union(&copy, &threes) && set_intersect(&copy, &evens), "hh_set_intersect failed");
+    ASSERT(set_intersect(&copy, &seeded), "hh_set_intersect failed with different seeds");
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        ASSERT(set_has(&sixes, &i, sizeof(i)) == (i % 6 == 0), "hh_set_intersect is incorrect: key = %zu", i);
+        ASSERT(set_has(&copy, &i, sizeof(i)) == (i % 30 == 0), "hh_set_intersect is incorrect: key = %zu", i);
+    }
+    // union with a differently seeded set, and deletion
+    ASSERT(set_union(&sixes, &seeded), "hh_set_union failed with different seeds");
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        ASSERT(set_has(&sixes, &i, sizeof(i)) == (i % 6 == 0 || i % 5 == 0), "hh_set_union is incorrect: key = %zu", i);
+        if(i % 5 == 0) ASSERT(set_del(&sixes, &i, sizeof(i)), "hh_set_del failed: key = %zu", i);
+    }
+    ASSERT(!set_has(&sixes, &zero, sizeof(zero)) && !set_del(&sixes, &zero, sizeof(zero)), "hh_set_del left a member");
+    ASSERT(set_add_cstr(&copy, "key") && set_has_cstr(&copy, "key") && set_del_cstr(&copy, "key"), "hh_set_t cstr helpers failed");
+    // a larger set unioned into a smaller one with a different seed, both ways around
+    set_t small = {0}, large = {0};
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        if(i % 7 == 0) ASSERT(set_add(&small, &i, sizeof(i)), "hh_set_add failed: key = %zu", i);
+        if(i % 5 == 0) ASSERT(set_add(&large, &i, sizeof(i)), "hh_set_add failed: key = %zu", i);
+    }
+    ASSERT(set_union(&small, &large) && set_union(&small, &seeded), "hh_set_union failed");
+    ASSERT(set_union(&large, &small) && large.map.count == small.map.count, "hh_set_union failed");
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        ASSERT(set_has(&small, &i, sizeof(i)) == (i % 7 == 0 || i % 5 == 0), "hh_set_union is incorrect: key = %zu", i);
+        ASSERT(set_has(&large, &i, sizeof(i)) == (i % 7 == 0 || i % 5 == 0), "hh_set_union is incorrect: key = %zu", i);
+    }
+    set_free(&small);
+    set_free(&large);
+    set_free(&evens);
+    set_free(&threes);
+    set_free(&seeded);
+    set_free(&sixes);
+    set_free(&copy);
+}
+
+static void
+test_map_define(void) {
+    u64map_t map = {0};
+    ASSERT(u64map_get(&map, 0) == NULL, "HH_MAP_DEFINE map found a key before initialization");
+    for(uint64_t i = 0; i < KEY_COUNT; ++i)
+        ASSERT(u64map_insert(&map, i * 7, (double) i), "HH_MAP_DEFINE insert failed: key = %llu", (unsigned long long) i);
+    ASSERT(map.count == KEY_COUNT, "HH_MAP_DEFINE count is incorrect: count = %zu", map.count);
+    for(uint64_t i = 0; i < KEY_COUNT; ++i) {
+        double* val = u64map_get(&map, i * 7);
+        ASSERT(val != NULL && *val == (double) i, "HH_MAP_DEFINE get failed: key = %llu", (unsigned long long) i * 7);
+        ASSERT(u64map_get(&map, i * 7 + 1) == NULL, "HH_MAP_DEFINE get found a non-member");
+    }
+    // remove and reinsert repeatedly, so the table fills with tombstones
+    for(size_t round = 0; round < 8; ++round) {
+        for(uint64_t i = 0; i < KEY_COUNT; i += 2) ASSERT(u64map_remove(&map, i * 7), "HH_MAP_DEFINE remove failed");
+        ASSERT(!u64map_remove(&map, 0), "HH_MAP_DEFINE removed a key twice");
+        for(uint64_t i = 0; i < KEY_COUNT; i += 2) {
+            bool inserted;
+            double* val = u64map_get_or_insert(&map, i * 7, &inserted);
+            ASSERT(val != NULL && inserted && *val == 0.0, "HH_MAP_DEFINE get_or_insert failed");
+            *val = (double) i;
+        }
+    }
+    ASSERT(map.count == KEY_COUNT, "HH_MAP_DEFINE count is incorrect after removals: count = %zu", map.count);
+    size_t count = 0;
+    double sum = 0.0;
+    for(u64map_entry_t* entry = u64map_next(&map, NULL); entry != NULL; entry = u64map_next(&map, entry)) {
+        ASSERT(entry->val * 7.0 == (double) entry->key, "HH_MAP_DEFINE iteration returned a mismatched entry");
+        ++count;
+        sum += entry->val;
+    }
+    ASSERT(count == KEY_COUNT && sum == (double) KEY_COUNT * (KEY_COUNT - 1) / 2, 
+        "HH_MAP_DEFINE iteration visited %zu entries", count);
+    u64map_free(&map);
+    // custom hash and eq
+    padded_map_t padded = { .bucket_count = 1024 };
+    ASSERT(padded_map_reserve(&padded, KEY_COUNT) && padded.bucket_count >= KEY_COUNT, "HH_MAP_DEFINE reserve failed");
+    size_t bucket_count = padded.bucket_count;
+    for(int i = 0; i < KEY_COUNT; ++i) 
+        padded_map_insert(&padded, (padded_key) { .tag = (uint8_t) (i % 3), .id = (uint64_t) i / 3 }, i);
+    ASSERT(padded.bucket_count == bucket_count, "HH_MAP_DEFINE rehashed after reserve");
+    for(int i = 0; i < KEY_COUNT; ++i) {
+        int* val = padded_map_get(&padded, (padded_key) { .tag = (uint8_t) (i % 3), .id = (uint64_t) i / 3 });
+        ASSERT(val != NULL && *val == i, "HH_MAP_DEFINE_WITH get failed: key = %d", i);
+    }
+    padded_map_free(&padded);
+}
+
+static void
+test_map_freeze(void) {
+    map_frozen_t frozen;
+    map_t map = { .bucket_count = 16, .incremental = true };
+    ASSERT(map_freeze(&map, &frozen), "hh_map_freeze failed on an empty map");
+    ASSERT(map_frozen_get_val(&frozen, "missing", 7) == NULL, "Empty hh_map_frozen_t found a key");
+    map_frozen_free(&frozen);
+    // freeze while an incremental rehash is in progress, so both tables contribute entries
+    size_t i = 0, val;
+    do {
+        map_insert(&map, &i, sizeof(i), &i, sizeof(i));
+        ++i;
+    } while(map.old.ctrl == NULL || map.count < 1000);
+    ASSERT(map_freeze(&map, &frozen), "hh_map_freeze failed");
+    DBG("Froze %zu entries: bucket_count = %zu, size_data = %zu", frozen.count, frozen.bucket_count, frozen.size_data);
+    ASSERT(frozen.count == i, "hh_map_frozen_t count is incorrect: count = %zu", frozen.count);
+    for(size_t j = 0; j < i; ++j) {
+        map_entry_t entry = map_frozen_get(&frozen, &j, sizeof(j));
+        ASSERT(entry.val != NULL && entry.size_val == sizeof(size_t), "hh_map_frozen_get failed to find key: key = %zu", j);
+        memcpy(&val, entry.val, sizeof(val));
+        ASSERT(val == j, "hh_map_frozen_get returned incorrect value: key = %zu, val = %zu", j, val);
+    }
+    for(size_t j = i; j < i * 2; ++j)
+        ASSERT(map_frozen_get_val(&frozen, &j, sizeof(j)) == NULL, "hh_map_frozen_get found a non-member: key = %zu", j);
+    // the frozen table owns its copies
+    map_free(&map);
+    ASSERT(map_frozen_get_val_with_cstr_key(&frozen, "key") == NULL, "hh_map_frozen_get found a non-member");
+    i = 7;
+    ASSERT(map_frozen_get_val(&frozen, &i, sizeof(i)) != NULL, "hh_map_frozen_t depends on the source map");
+    map_frozen_free(&frozen);
+}
+
+static void
+test_map_save(void) {
+    const char* path = PROJECT_ROOT "tests/assets/test_map_save.bin";
+    map_frozen_t frozen;
+    map_t map = { .seed = hh_hash_seed_random() };
+    char key[32];
+    for(size_t i = 0; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        map_insert(&map, key, strlen(key), &i, sizeof(i));
+    }
+    ASSERT(map_save(&map, path), "hh_map_save failed: path = %s", path);
+    map_free(&map);
+    ASSERT(map_open_mapped(path, &frozen), "hh_map_open_mapped failed: path = %s", path);
+    ASSERT(frozen.mapping != NULL && frozen.count == KEY_COUNT, "hh_map_open_mapped produced %zu entries", frozen.count);
+    for(size_t i = 0, val; i < KEY_COUNT; ++i) {
+        snprintf(key, ARR_LEN(key), "key_%zu", i);
+        const void* ptr = map_frozen_get_val(&frozen, key, strlen(key));
+        ASSERT(ptr != NULL, "Mapped hh_map_frozen_t failed to find key: key = %s", key);
+        memcpy(&val, ptr, sizeof(val));
+        ASSERT(val == i, "Mapped hh_map_frozen_t returned incorrect value: key = %s, val = %zu", key, val);
+    }
+    ASSERT(map_frozen_get_val_with_cstr_key(&frozen, "missing") == NULL, "Mapped hh_map_frozen_t found a non-member");
+    map_frozen_free(&frozen);
+    // empty maps round-trip as well
+    ASSERT(map_save(&map, path) && map_open_mapped(path, &frozen), "hh_map_save failed on an empty map");
+    ASSERT(frozen.count == 0 && map_frozen_get_val(&frozen, "key_0", 5) == NULL, "Empty snapshot has entries");
+    map_frozen_free(&frozen);
+    // a truncated file must be rejected
+    FILE* fp = fopen(path, "wb");
+    ASSERT(fp != NULL && fwrite("HMAP", 1, 4, fp) == 4 && fclose(fp) == 0, "Failed to write %s", path);
+    ASSERT(!map_open_mapped(path, &frozen), "hh_map_open_mapped accepted a truncated file");
+    remove(path);
+}
+
+#define THREAD_COUNT 4
+
+// the key itself, as users often hash integers
+static size_t
+test_hash_identity(const void* key, size_t size_key) {
+    size_t hash = 0;
+    memcpy(&hash, key, HH_MIN(size_key, sizeof(hash)));
+    return hash;
+}
+
+#ifndef _WIN32
+struct concurrent_ctx {
+    map_concurrent_t* map;
+    size_t first;
+};
+
+// each thread inserts a disjoint range, while reading back the range of its neighbour
+static void*
+test_map_concurrent_worker(void* arg) {
+    struct concurrent_ctx* ctx = arg;
+    size_t val, neighbour = (ctx->first + KEY_COUNT) % (KEY_COUNT * THREAD_COUNT);
+    for(size_t i = ctx->first; i < ctx->first + KEY_COUNT; ++i) {
+        map_concurrent_insert(ctx->map, &i, sizeof(i), &i, sizeof(i));
+        size_t j = neighbour + i - ctx->first;
+        if(map_concurrent_get(ctx->map, &j, sizeof(j), &val, sizeof(val))) 
+            ASSERT(val == j, "hh_map_concurrent_get read a torn value: key = %zu, val = %zu", j, val);
+    }
+    return NULL;
+}
+#endif // _WIN32
+
+static void
+test_map_concurrent(void) {
+    // incremental shards migrate under their write lock, so concurrent lookups never race with it
+    map_concurrent_t map = { .shard_count = 10, .init = { .incremental = true } };
+    ASSERT(map_concurrent_init(&map), "hh_map_concurrent_init failed");
+    ASSERT(map.shard_count == 16, "hh_map_concurrent_init did not round shard_count: shard_count = %zu", map.shard_count);
+#ifndef _WIN32
+    pthread_t threads[THREAD_COUNT];
+    struct concurrent_ctx ctx[THREAD_COUNT];
+    for(size_t i = 0; i < THREAD_COUNT; ++i) {
+        ctx[i] = (struct concurrent_ctx) { .map = &map, .first = i * KEY_COUNT };
+        ASSERT(pthread_create(&threads[i], NULL, test_map_concurrent_worker, &ctx[i]) == 0, "Failed to spawn thread");
+    }
+    for(size_t i = 0; i < THREAD_COUNT; ++i) pthread_join(threads[i], NULL);
+#else
+    for(size_t i = 0; i < KEY_COUNT * THREAD_COUNT; ++i) map_concurrent_insert(&map, &i, sizeof(i), &i, sizeof(i));
+#endif // _WIN32
+    ASSERT(map_concurrent_count(&map) == KEY_COUNT * THREAD_COUNT, 
+        "hh_map_concurrent_t lost entries: count = %zu", map_concurrent_count(&map));
+    size_t val;
+    for(size_t i = 0; i < KEY_COUNT * THREAD_COUNT; ++i) {
+        ASSERT(map_concurrent_get(&map, &i, sizeof(i), &val, sizeof(val)) && val == i, 
+            "hh_map_concurrent_get failed: key = %zu", i);
+        if(i % 2 == 0) ASSERT(map_concurrent_remove(&map, &i, sizeof(i)), "hh_map_concurrent_remove failed: key = %zu", i);
+    }
+    ASSERT(map_concurrent_count(&map) == KEY_COUNT * THREAD_COUNT / 2, 
+        "hh_map_concurrent_remove left count = %zu", map_concurrent_count(&map));
+    map_concurrent_free(&map);
+    // a custom hash that only varies in its low bits still spreads across every shard
+    map_concurrent_t identity = { .init = { .hash = test_hash_identity } };
+    ASSERT(map_concurrent_init(&identity), "hh_map_concurrent_init failed");
+    for(size_t i = 0; i < KEY_COUNT; ++i) map_concurrent_insert(&identity, &i, sizeof(i), NULL, 0);
+    for(size_t i = 0; i < identity.shard_count; ++i) {
+        ASSERT(identity.shards[i].map.count > KEY_COUNT / identity.shard_count / 2, 
+            "hh_map_concurrent_t crowded an identity hash into few shards: shard = %zu, count = %zu", i, identity.shards[i].map.count);
+    }
+    map_concurrent_free(&identity);
+}
+
+int
+main(void) {
+    test_hash();
+    test_map_basic(false);
+    test_map_basic(true);
+    test_map_reserve();
+    test_map_migration();
+    test_map_stored_hash(false);
+    test_map_stored_hash(true);
+    test_map_upsert();
+    test_map_it_remove(false);
+    test_map_it_remove(true);
+    test_map_get_many();
+    test_map_concurrent();
+    test_map_compact();
+    test_map_storage(false);
+    test_map_storage(true);
+    test_map_build(false);
+    test_map_build(true);
+    test_set();
+    test_map_define();
+    test_map_freeze();
+    test_map_save();
+    return 0;
+}